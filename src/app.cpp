@@ -1,8 +1,13 @@
 #include "app.h"
+#include "jsonwriter.h"
+#include "pacer.h"
+#include "resolver.h"
 
 #include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <unordered_map>
 #include <nlohmann/json.hpp>
 
 #ifndef _WIN32
@@ -31,6 +36,10 @@ void App::load_servers(const std::string& path) {
         return;
     }
 
+    for (auto& se : servers) {
+        player_index.remove(se.id);
+        rule_index.remove(se.id);
+    }
     servers.clear();
     selected = -1;
     int ord = 0;
@@ -40,6 +49,9 @@ void App::load_servers(const std::string& path) {
         se.info.port = entry.value("port", 7777);
         se.info.status = "idle";
         se.order = entry.value("order", ord);
+        se.id = next_id_++;
+        parse_query_protocol(entry.value("protocol", ""), se.protocol);
+        dns_resolver().prefetch(se.info.address);
         servers.push_back(std::move(se));
         ++ord;
     }
@@ -65,6 +77,25 @@ void App::load_servers(const std::string& path) {
 
     if (j.contains("font_size_idx"))
         font_size_idx = std::clamp(j["font_size_idx"].get<int>(), 0, 3);
+    if (j.contains("cache_ttl"))
+        cache_ttl = std::clamp(j["cache_ttl"].get<float>(), 0.0f, 300.0f);
+    if (j.contains("refresh_policy")) {
+        auto& rp = j["refresh_policy"];
+        refresh_policy.min_interval = std::clamp(rp.value("min_interval", 15.0f), 5.0f, 600.0f);
+        refresh_policy.max_interval = std::clamp(rp.value("max_interval", 300.0f), 5.0f, 3600.0f);
+        refresh_policy.budget = std::clamp(rp.value("budget", 20.0f), 1.0f, 1000.0f);
+    }
+    if (j.contains("pacing")) {
+        auto& p = j["pacing"];
+        SendPacer::Limits limits;
+        limits.packets_per_second = std::clamp(p.value("packets_per_second", 1000.0), 0.0, 100000.0);
+        limits.per_host_per_second = std::clamp(p.value("per_host_per_second", 20.0), 0.0, 10000.0);
+        limits.adaptive = p.value("adaptive", true);
+        send_pacer().set_limits(limits);
+    }
+    collector_address = j.value("collector", collector_address);
+    if (j.value("collector_attached", false) && !collector_address.empty())
+        attach_collector(collector_address);
 }
 
 void App::save_servers(const std::string& path) const {
@@ -77,36 +108,59 @@ void App::save_servers(const std::string& path) const {
     }
 #endif
 
-    json j;
-    j["servers"] = json::array();
+    FILE* fp = std::fopen(path.c_str(), "w");
+    if (!fp) return;
+
     // Save in user-defined order
     std::vector<const ServerEntry*> ordered;
     for (auto& se : servers)
         ordered.push_back(&se);
     std::sort(ordered.begin(), ordered.end(),
         [](const ServerEntry* a, const ServerEntry* b) { return a->order < b->order; });
-    for (auto* se : ordered) {
-        j["servers"].push_back({
-            {"address", se->info.address},
-            {"port", se->info.port},
-            {"order", se->order}
-        });
-    }
-
-    j["master_servers"] = json::array();
-    for (auto& ms : master_servers) {
-        j["master_servers"].push_back({
-            {"host", ms.host},
-            {"port", ms.port}
-        });
-    }
 
-    j["font_size_idx"] = font_size_idx;
-
-    std::ofstream f(path);
-    if (f.is_open()) {
-        f << j.dump(2) << std::endl;
+    {
+        JsonWriter w(fp, 2);
+        w.begin_object();
+        w.key("servers").begin_array();
+        for (auto* se : ordered) {
+            w.begin_object();
+            w.key("address").value(se->info.address);
+            w.key("port").value(se->info.port);
+            w.key("order").value(se->order);
+            if (se->protocol != QueryProtocol::Native)
+                w.key("protocol").value(query_protocol_name(se->protocol));
+            w.end_object();
+        }
+        w.end_array();
+
+        w.key("master_servers").begin_array();
+        for (auto& ms : master_servers) {
+            w.begin_object();
+            w.key("host").value(ms.host);
+            w.key("port").value(ms.port);
+            w.end_object();
+        }
+        w.end_array();
+
+        w.key("font_size_idx").value(font_size_idx);
+        w.key("cache_ttl").value(static_cast<double>(cache_ttl));
+        w.key("refresh_policy").begin_object();
+        w.key("min_interval").value(static_cast<double>(refresh_policy.min_interval));
+        w.key("max_interval").value(static_cast<double>(refresh_policy.max_interval));
+        w.key("budget").value(static_cast<double>(refresh_policy.budget));
+        w.end_object();
+        auto limits = send_pacer().limits();
+        w.key("pacing").begin_object();
+        w.key("packets_per_second").value(limits.packets_per_second);
+        w.key("per_host_per_second").value(limits.per_host_per_second);
+        w.key("adaptive").value(limits.adaptive);
+        w.end_object();
+        w.key("collector").value(collector_address);
+        w.key("collector_attached").value(collector_attached());
+        w.end_object();
+        w.newline();
     }
+    std::fclose(fp);
 }
 
 void App::add_server(const std::string& ip, uint16_t port) {
@@ -114,16 +168,20 @@ void App::add_server(const std::string& ip, uint16_t port) {
     se.info.address = ip;
     se.info.port = port;
     se.info.status = "idle";
+    se.id = next_id_++;
     // Assign order after last entry
     int max_order = 0;
     for (auto& s : servers)
         if (s.order > max_order) max_order = s.order;
     se.order = max_order + 1;
+    dns_resolver().prefetch(ip);
     servers.push_back(std::move(se));
 }
 
 void App::remove_server(int index) {
     if (index >= 0 && index < static_cast<int>(servers.size())) {
+        player_index.remove(servers[index].id);
+        rule_index.remove(servers[index].id);
         servers.erase(servers.begin() + index);
         if (selected == index) selected = -1;
         else if (selected > index) --selected;
@@ -136,53 +194,125 @@ void App::refresh_all() {
     }
 }
 
-void App::refresh_one(int index) {
+void App::refresh_one(int index, bool force) {
     if (index < 0 || index >= static_cast<int>(servers.size())) return;
-    auto& se = servers[index];
+    start_query(servers[index], force, QueryPriority::Favorite, QueryProfile::Detail);
+}
+
+void App::start_query(ServerEntry& se, bool force, QueryPriority priority,
+                      QueryProfile profile) {
     if (se.state == QueryState::Querying) return;
+    // The server whose details are open keeps them up to date
+    if (se.id == focus_selected_id_ || se.id == focus_hovered_id_)
+        profile = QueryProfile::Detail;
+
+    if (!force && negative_cache.presumed_offline(QueryCache::key(se.info.address, se.info.port))) {
+        se.info.online = false;
+        se.info.status = "presumed offline";
+        se.state = QueryState::Done;
+        se.filter_gen = 0;
+        return;
+    }
 
     se.state = QueryState::Querying;
     se.info.status = "querying";
-    std::string ip = se.info.address;
-    uint16_t port = se.info.port;
-    se.future = std::async(std::launch::async, [ip, port]() {
-        return query_server(ip, port);
-    });
+    se.filter_gen = 0;
+    QueryOptions opts;
+    opts.protocol = se.protocol;
+    opts.query_port = se.info.query_port;
+    opts.profile = profile;
+    // The ping breakdown is only shown for the server whose details are open
+    if (se.id == focus_selected_id_) opts.ping_samples = 3;
+    se.future = query_cache.request(se.info.address, se.info.port, force, opts, priority);
 }
 
-void App::poll_results() {
-    for (auto& se : servers) {
-        if (se.state != QueryState::Querying) continue;
-        if (!se.future.valid()) continue;
-
-        auto status = se.future.wait_for(std::chrono::milliseconds(0));
-        if (status == std::future_status::ready) {
-            auto result = se.future.get();
-            // Preserve address/port from config
-            std::string addr = se.info.address;
-            uint16_t port = se.info.port;
-            se.info = std::move(result);
-            se.info.address = addr;
-            se.info.port = port;
-            se.state = QueryState::Done;
+// Copy a finished query into the entry. Returns false if still pending.
+bool App::take_result(ServerEntry& se) {
+    if (se.state != QueryState::Querying) return false;
+    if (!se.future.valid()) return false;
+
+    auto status = se.future.wait_for(std::chrono::milliseconds(0));
+    if (status != std::future_status::ready) return false;
+
+    // Preserve address/port from config
+    ServerInfo previous = std::move(se.info);
+    const std::string& addr = previous.address;
+    uint16_t port = previous.port;
+    se.info = se.future.get();
+    se.info.address = addr;
+    se.info.port = port;
+    se.future = {};
+    se.state = QueryState::Done;
+    // A List result has no players or rules. Rows not being looked at drop
+    // theirs (that's the memory saved); the open one keeps them, and their
+    // hashes so the indexes stay as they are, until Detail arrives.
+    bool focused = se.id == focus_selected_id_ || se.id == focus_hovered_id_;
+    if (focused && se.info.online && previous.online) {
+        if (!(se.info.sections & SECTION_PLAYERS)) {
+            se.info.players = previous.players;
+            se.info.players_hash = previous.players_hash;
         }
+        if (!(se.info.sections & SECTION_RULES)) {
+            se.info.variables = previous.variables;
+            se.info.rules_hash = previous.rules_hash;
+        }
+    }
+    std::string key = QueryCache::key(addr, port);
+    negative_cache.record(key, se.info.online, se.info.queried_at);
+    if (history.is_open()) {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        history.append(key, std::chrono::duration_cast<std::chrono::seconds>(now).count(), se.info);
     }
+    se.filter_gen = 0;
+    // A section with the same reply hash as this row's last result is
+    // already indexed (hash 0 = unknown, e.g. from a collector)
+    bool players_changed = se.info.players_hash == 0 || se.info.players_hash != previous.players_hash;
+    if (players_changed)
+        player_index.update(se.id, se.info.players);
+    if (se.info.rules_hash == 0 || se.info.rules_hash != previous.rules_hash)
+        rule_index.update(se.id, se.info.variables);
+    // Rosters are only compared when both results have them; free slots
+    // only need the player counts
+    bool both_rosters = (se.info.sections & previous.sections & SECTION_PLAYERS) != 0;
+    if (previous.online && se.info.online &&
+        (se.info.num_players != previous.num_players || (both_rosters && players_changed)))
+        roster_events.diff(key, previous, se.info, both_rosters);
+
+    // A result that was worth fetching: joins, leaves, scores, map or state
+    bool changed = previous.online != se.info.online ||
+                   previous.num_players != se.info.num_players ||
+                   previous.map_name != se.info.map_name ||
+                   (both_rosters && previous.players.size() != se.info.players.size());
+    for (size_t i = 0; !changed && both_rosters && i < se.info.players.size(); ++i) {
+        auto& a = previous.players[i];
+        auto& b = se.info.players[i];
+        changed = a.name != b.name || a.score != b.score || a.team != b.team;
+    }
+    se.activity += 0.3f * ((changed ? 1.0f : 0.0f) - se.activity);
+    return true;
+}
+
+void App::poll_results() {
+    query_cache.set_ttl(std::chrono::milliseconds(static_cast<int>(cache_ttl * 1000)));
+    for (auto& se : servers)
+        take_result(se);
     poll_internet_results();
     poll_master_results();
+    apply_filters();
+    query_cache.prune();
+    history.refresh(); // read-only: follow the collector's recording
 }
 
-void App::refresh_internet_one(int index) {
+void App::refresh_internet_one(int index, bool force) {
+    if (collector_attached()) return; // the collector keeps them fresh
     if (index < 0 || index >= static_cast<int>(internet_servers.size())) return;
-    auto& se = internet_servers[index];
-    if (se.state == QueryState::Querying) return;
+    start_query(internet_servers[index], force, QueryPriority::Background, internet_profile());
+}
 
-    se.state = QueryState::Querying;
-    se.info.status = "querying";
-    std::string ip = se.info.address;
-    uint16_t port = se.info.port;
-    se.future = std::async(std::launch::async, [ip, port]() {
-        return query_server(ip, port);
-    });
+QueryProfile App::internet_profile() const {
+    return internet_details || internet_filter.uses_rules() || internet_player_search
+               ? QueryProfile::Detail
+               : QueryProfile::List;
 }
 
 void App::refresh_internet_all() {
@@ -191,114 +321,269 @@ void App::refresh_internet_all() {
     }
 }
 
-void App::poll_internet_results() {
-    for (auto& se : internet_servers) {
-        if (se.state != QueryState::Querying) continue;
-        if (!se.future.valid()) continue;
-
-        auto status = se.future.wait_for(std::chrono::milliseconds(0));
-        if (status == std::future_status::ready) {
-            auto result = se.future.get();
-            std::string addr = se.info.address;
-            uint16_t port = se.info.port;
-            se.info = std::move(result);
-            se.info.address = addr;
-            se.info.port = port;
-            se.state = QueryState::Done;
-        }
-    }
+// A fraction in [0, 1) that differs between rows and salts, to spread
+// refreshes that would otherwise come due together.
+static float refresh_spread(uint32_t id, uint64_t salt) {
+    uint64_t h = (static_cast<uint64_t>(id) << 32 ^ salt) * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return static_cast<float>(h >> 40) / static_cast<float>(1u << 24);
 }
 
-// Normalize a raw cdkey string: filter characters, uppercase, insert dashes.
-static std::string normalize_cdkey(const std::string& raw) {
-    std::string key;
-    for (char ch : raw) {
-        if ((ch >= '0' && ch <= '9') ||
-            (ch >= 'a' && ch <= 'z') ||
-            (ch >= 'A' && ch <= 'Z') ||
-            ch == '-')
-            key.push_back(ch);
-        else if (ch == ' ' || ch == '_')
-            key.push_back('-');
-        else
-            break; // stop at first invalid char (like UT2004 does)
+void App::auto_refresh(bool favorites, bool internet) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_plan_ < std::chrono::seconds(1)) return;
+    // Due times left over from before auto-refresh was last turned off are
+    // all in the past; plan every row afresh
+    bool resumed = now - last_plan_ > std::chrono::seconds(5);
+    last_plan_ = now;
+
+    std::vector<ServerEntry*> rows;
+    if (favorites)
+        for (auto& se : servers) rows.push_back(&se);
+    if (internet && !collector_attached())
+        for (auto& se : internet_servers) rows.push_back(&se);
+    if (rows.empty()) return;
+
+    // Native queries send an info request per ping sample, plus players and
+    // rules requests for Detail
+    QueryProfile inet_profile = internet_profile();
+    auto profile_of = [&](size_t i) {
+        return favorites && i < servers.size() ? QueryProfile::Detail : inet_profile;
+    };
+    auto packets_per_query = [](QueryProfile p) {
+        return static_cast<float>(QueryOptions{}.ping_samples + (p == QueryProfile::Detail ? 2 : 0));
+    };
+    float lo = std::max(1.0f, refresh_policy.min_interval);
+    float hi = std::max(lo, refresh_policy.max_interval);
+    float rate = 0.0f;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        auto* se = rows[i];
+        if (negative_cache.presumed_offline(QueryCache::key(se->info.address, se->info.port))) {
+            se->refresh_interval = hi; // probed on the backoff schedule, not ours
+            continue;
+        }
+        float idle = 1.0f - std::clamp(se->activity, 0.0f, 1.0f);
+        float t = lo + (hi - lo) * idle * idle;
+        if (!se->info.online || se->info.num_players == 0)
+            t = std::max(t, std::min(hi, lo * 4));
+        se->refresh_interval = t;
+        rate += packets_per_query(profile_of(i)) / t;
     }
-    for (auto& c : key) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
-    if (key.find('-') == std::string::npos && key.size() == 20) {
-        key = key.substr(0,5) + "-" + key.substr(5,5) + "-" +
-              key.substr(10,5) + "-" + key.substr(15,5);
+    float budget = std::max(1.0f, refresh_policy.budget);
+    float scale = rate > budget ? rate / budget : 1.0f;
+
+    using Clock = std::chrono::steady_clock;
+    auto salt = static_cast<uint64_t>(now.time_since_epoch().count());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        auto* se = rows[i];
+        se->refresh_interval *= scale;
+        if (se->state == QueryState::Querying) continue;
+        auto interval = [&](float f) {
+            return std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<float>(se->refresh_interval * f));
+        };
+        // A row new to the plan first comes due at a random point of its
+        // interval, so rows listed or refreshed together don't stay in step
+        // and the planned rate holds from the start
+        if (resumed || se->next_refresh == Clock::time_point{}) {
+            se->next_refresh = now + interval(refresh_spread(se->id, 0));
+            continue;
+        }
+        // A manual refresh since pushes the next one back
+        if (se->state == QueryState::Done)
+            se->next_refresh = std::max(se->next_refresh, se->info.queried_at + interval(0.9f));
+        if (now < se->next_refresh) continue;
+
+        bool favorite = favorites && i < servers.size();
+        start_query(*se, false, favorite ? QueryPriority::Favorite : QueryPriority::Background,
+                    profile_of(i));
+        // Due again after 0.9 to 1.1 intervals
+        se->next_refresh = now + interval(0.9f + 0.2f * refresh_spread(se->id, salt));
     }
-    if (key.size() > 23)
-        key = key.substr(0, 23);
-    return key;
 }
 
-#ifdef _WIN32
-#include <windows.h>
-static std::string read_cdkey_from_registry() {
-    // Try WOW6432Node first (32-bit app on 64-bit Windows, or explicit path)
-    const char* subkeys[] = {
-        "SOFTWARE\\WOW6432Node\\Unreal Technology\\Installed Apps\\UT2004",
-        "SOFTWARE\\Unreal Technology\\Installed Apps\\UT2004",
+void App::set_focus(std::vector<ServerEntry>& list, const std::vector<int>& visible,
+                    int selected, int hovered) {
+    auto id_of = [&](int i) {
+        return i >= 0 && i < static_cast<int>(list.size()) ? list[i].id : 0;
     };
-    for (auto subkey : subkeys) {
-        HKEY hkey = nullptr;
-        if (RegOpenKeyExA(HKEY_LOCAL_MACHINE, subkey, 0, KEY_READ, &hkey) == ERROR_SUCCESS) {
-            char buf[256] = {};
-            DWORD size = sizeof(buf) - 1;
-            DWORD type = 0;
-            if (RegQueryValueExA(hkey, "CDKey", nullptr, &type, reinterpret_cast<BYTE*>(buf), &size) == ERROR_SUCCESS
-                && type == REG_SZ) {
-                RegCloseKey(hkey);
-                return std::string(buf);
-            }
-            RegCloseKey(hkey);
-        }
+    auto now = std::chrono::steady_clock::now();
+    focus_selected_id_ = id_of(selected);
+    uint32_t hovered_id = id_of(hovered);
+    if (hovered_id != focus_hovered_id_) hovered_since_ = now;
+    focus_hovered_id_ = hovered_id;
+
+    // Fetch the details of a List (or swept) result once it is looked at;
+    // a hover must last a moment so sweeping the mouse over the list
+    // doesn't query every row it passes
+    auto complete = [&](int i, QueryPriority priority) {
+        if (i < 0 || i >= static_cast<int>(list.size())) return;
+        auto& se = list[i];
+        if (se.state == QueryState::Done && se.info.online && se.info.sections != SECTION_ALL)
+            start_query(se, false, priority, QueryProfile::Detail);
+    };
+    complete(selected, QueryPriority::Selected);
+    if (now - hovered_since_ >= std::chrono::milliseconds(300))
+        complete(hovered, QueryPriority::Visible);
+
+    std::vector<std::string> keys;
+    keys.reserve(visible.size());
+    for (int i : visible)
+        if (i >= 0 && i < static_cast<int>(list.size()))
+            keys.push_back(QueryCache::key(list[i].info.address, list[i].info.port,
+                                           list[i].protocol));
+    std::string selected_key;
+    if (selected >= 0 && selected < static_cast<int>(list.size()))
+        selected_key = QueryCache::key(list[selected].info.address, list[selected].info.port,
+                                       list[selected].protocol);
+    query_cache.set_focus(keys, selected_key);
+}
+
+void App::sweep_internet() {
+    if (sweeping() || collector_attached()) return;
+    std::vector<SweepTarget> targets;
+    for (auto& se : internet_servers) {
+        if (se.state == QueryState::Querying) continue;
+        if (negative_cache.presumed_offline(QueryCache::key(se.info.address, se.info.port)))
+            continue;
+        targets.push_back({se.info.address, se.info.port, se.info.query_port});
+        se.info.status = "sweeping";
+        se.filter_gen = 0;
     }
-    return {};
+    if (targets.empty()) return;
+    sweep_future_ = std::async(std::launch::async, [targets = std::move(targets)]() {
+        std::vector<ServerInfo> results(targets.size());
+        sweep_servers(targets, QueryOptions{}, [&](size_t i, const ServerInfo& info) {
+            results[i] = info;
+        });
+        return results;
+    });
 }
-#endif
 
-void App::load_cdkey(const std::string& path) {
-    std::string raw;
+// Hand swept results to their rows like streamed collector results. Rows
+// that started a full query meanwhile keep waiting for that instead.
+void App::poll_sweep_results() {
+    if (!sweep_future_.valid()) return;
+    if (sweep_future_.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready) return;
+
+    std::unordered_map<std::string, size_t> rows;
+    for (size_t i = 0; i < internet_servers.size(); ++i)
+        rows[QueryCache::key(internet_servers[i].info.address, internet_servers[i].info.port)] = i;
+
+    for (auto& info : sweep_future_.get()) {
+        auto it = rows.find(QueryCache::key(info.address, info.port));
+        if (it == rows.end()) continue; // list replaced by a master query
+        auto& se = internet_servers[it->second];
+        if (se.state == QueryState::Querying) continue;
+        std::promise<ServerInfo> done;
+        done.set_value(std::move(info));
+        se.future = done.get_future().share();
+        se.state = QueryState::Querying;
+        take_result(se);
+    }
+}
 
-    // Try file first
-    std::ifstream f(path);
-    if (f.is_open()) {
-        std::getline(f, raw);
-        std::fprintf(stderr, "cdkey: read from file '%s'\n", path.c_str());
+void App::poll_internet_results() {
+    poll_collector_results();
+    poll_sweep_results();
+    // Once every row's details are wanted, rows holding a List (or swept)
+    // result are queried again in full rather than at their next refresh
+    bool detail = internet_profile() == QueryProfile::Detail && !collector_attached();
+    internet_details_pending_ = 0;
+    for (auto& se : internet_servers) {
+        take_result(se);
+        if (!detail || !se.info.online || se.info.sections == SECTION_ALL) continue;
+        if (se.state == QueryState::Done)
+            start_query(se, false, QueryPriority::Background, QueryProfile::Detail);
+        ++internet_details_pending_;
     }
+}
 
-#ifdef _WIN32
-    // Fall back to Windows registry
-    if (raw.empty()) {
-        raw = read_cdkey_from_registry();
-        if (!raw.empty())
-            std::fprintf(stderr, "cdkey: read from Windows registry\n");
+void App::attach_collector(const std::string& address) {
+    collector_address = address;
+    for (auto& se : internet_servers) {
+        player_index.remove(se.id);
+        rule_index.remove(se.id);
     }
-#endif
+    internet_servers.clear();
+    internet_selected = -1;
+    master_status.clear();
+    collector_.start(address);
+}
 
-    if (raw.empty()) {
-        std::fprintf(stderr, "cdkey: not found (no file '%s'%s)\n",
-                     path.c_str(),
-#ifdef _WIN32
-                     " and not in registry"
-#else
-                     ""
-#endif
-                     );
-        return;
+void App::detach_collector() {
+    collector_.stop();
+}
+
+// Hand each streamed result to its row as an already-completed query, so it
+// is taken by take_result() like any local one (indexes, filters, backoff).
+void App::poll_collector_results() {
+    if (!collector_attached()) return;
+    auto results = collector_.take();
+    if (results.empty()) return;
+
+    std::unordered_map<std::string, size_t> rows;
+    for (size_t i = 0; i < internet_servers.size(); ++i)
+        rows[QueryCache::key(internet_servers[i].info.address, internet_servers[i].info.port)] = i;
+
+    for (auto& info : results) {
+        auto [it, inserted] = rows.try_emplace(QueryCache::key(info.address, info.port),
+                                               internet_servers.size());
+        if (inserted) {
+            ServerEntry se;
+            se.info.address = info.address;
+            se.info.port = info.port;
+            se.id = next_id_++;
+            internet_servers.push_back(std::move(se));
+        }
+        auto& se = internet_servers[it->second];
+        std::promise<ServerInfo> done;
+        done.set_value(std::move(info));
+        se.future = done.get_future().share();
+        se.state = QueryState::Querying;
+        take_result(se);
+    }
+}
+
+static void apply_filter(std::vector<ServerEntry>& list, const ServerFilter& f,
+                         const RuleIndex& rules) {
+    uint32_t gen = f.generation();
+    for (auto& se : list) {
+        if (se.filter_gen == gen) continue;
+        se.filtered = !f.matches(se.info, se.id, rules);
+        se.filter_gen = gen;
     }
+}
+
+void App::apply_filters() {
+    apply_filter(servers, filter, rule_index);
+    apply_filter(internet_servers, internet_filter, rule_index);
+}
+
+int App::row_of(const std::vector<ServerEntry>& list, uint32_t id) const {
+    auto& rows = &list == &servers ? favorite_rows_ : internet_rows_;
+    auto valid = [&](int row) {
+        return row >= 0 && row < static_cast<int>(list.size()) && list[row].id == id;
+    };
+    auto it = rows.find(id);
+    if (it != rows.end() && valid(it->second)) return it->second;
+    // Sorted, edited or not mapped yet: rebuild
+    rows.clear();
+    for (int i = 0; i < static_cast<int>(list.size()); ++i)
+        rows.emplace(list[i].id, i);
+    it = rows.find(id);
+    return it != rows.end() ? it->second : -1;
+}
 
-    cdkey = normalize_cdkey(raw);
-    std::fprintf(stderr, "cdkey: loaded key len=%zu fmt='%.5s-...-%.5s'\n",
-                 cdkey.size(), cdkey.c_str(),
-                 cdkey.size() >= 5 ? cdkey.c_str() + cdkey.size() - 5 : "");
+void App::load_cdkey(const std::string& path) {
+    cdkey = read_cdkey(path);
 }
 
 void App::query_master(const std::string& host, uint16_t port,
                        const std::string& gametype_filter) {
     if (master_future_.valid()) return; // already querying
+    if (collector_attached()) return;   // the collector owns the list
     if (cdkey.empty()) {
         master_status = "error: no cdkey (create a 'cdkey' file"
 #ifndef _WIN32
@@ -321,6 +606,10 @@ void App::poll_master_results() {
     if (status != std::future_status::ready) return;
 
     auto qr = master_future_.get();
+    for (auto& se : internet_servers) {
+        player_index.remove(se.id);
+        rule_index.remove(se.id);
+    }
     internet_servers.clear();
     internet_selected = -1;
 
@@ -328,6 +617,7 @@ void App::poll_master_results() {
         ServerEntry se;
         se.info.address = me.ip;
         se.info.port = me.port;
+        se.info.query_port = me.query_port;
         se.info.name = me.name;
         se.info.map_name = me.map_name;
         se.info.gametype = me.game_type;
@@ -336,6 +626,7 @@ void App::poll_master_results() {
         se.info.flags = me.flags;
         se.info.status = "idle";
         se.info.online = true;
+        se.id = next_id_++;
         internet_servers.push_back(std::move(se));
     }
 
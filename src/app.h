@@ -1,10 +1,17 @@
 #pragma once
 
+#include "cache.h"
+#include "events.h"
+#include "filter.h"
+#include "history.h"
+#include "index.h"
 #include "master.h"
 #include "query.h"
+#include "remote.h"
 
 #include <future>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 enum class QueryState { Idle, Querying, Done };
@@ -12,8 +19,22 @@ enum class QueryState { Idle, Querying, Done };
 struct ServerEntry {
     ServerInfo info;
     QueryState state = QueryState::Idle;
-    std::future<ServerInfo> future;
+    std::shared_future<ServerInfo> future;
     int order = 0;
+    uint32_t id = 0;         // unique per App, stable across sorting
+    QueryProtocol protocol = QueryProtocol::Native;
+    bool filtered = false;   // hidden by the tab's filter expression
+    uint32_t filter_gen = 0; // ServerFilter generation last evaluated (0 = stale)
+    float activity = 1.0f;         // share of recent results that changed something (smoothed)
+    float refresh_interval = 0.0f; // seconds, planned by App::auto_refresh
+    std::chrono::steady_clock::time_point next_refresh{}; // App::auto_refresh's due time ({} = unplanned)
+};
+
+// Limits for the adaptive auto-refresh (App::auto_refresh).
+struct RefreshPolicy {
+    float min_interval = 15.0f;  // seconds, for servers whose state keeps changing
+    float max_interval = 300.0f; // for empty, offline or unchanging ones
+    float budget = 20.0f;        // query packets per second for all auto-refreshed servers
 };
 
 class App {
@@ -31,14 +52,83 @@ public:
     void add_server(const std::string& ip, uint16_t port);
     void remove_server(int index);
     void refresh_all();
-    void refresh_one(int index);
+    // force: probe even if the server is presumed offline
+    void refresh_one(int index, bool force = false);
     void poll_results();
 
     // Internet tab helpers
-    void refresh_internet_one(int index);
+    void refresh_internet_one(int index, bool force = false);
     void refresh_internet_all();
     void poll_internet_results();
 
+    // Internet tab rows are queried with the List profile (info only) and
+    // get players and rules when selected or hovered, unless every row's
+    // details are needed: a rule[] filter, a player search (set this while
+    // the tab's search box has text) or internet_details (the collector,
+    // which serves them). Favorites always get Detail.
+    bool internet_player_search = false;
+    bool internet_details = false;
+    QueryProfile internet_profile() const;
+    // Online rows still waiting for the details internet_profile() now
+    // wants; searches and rule filters miss them until this reaches 0.
+    size_t internet_details_pending() const { return internet_details_pending_; }
+
+    // Ping sweep of the Internet tab (see sweep_servers()): one info query
+    // per server from a single socket, ranking the whole list by ping and
+    // players in seconds.
+    void sweep_internet();
+    bool sweeping() const { return sweep_future_.valid(); }
+
+    // Adaptive "Auto Refresh All": each server is re-queried after its own
+    // interval, from min_interval for servers whose players, map or roster
+    // keep changing up to max_interval for idle ones, all stretched together
+    // to stay within the packet budget. Call every frame; plans once a second.
+    RefreshPolicy refresh_policy;
+    void auto_refresh(bool favorites, bool internet);
+
+    // Rows of `list` on screen (indices), its selected row and the row
+    // under the mouse (-1 for none): their queued queries run before the
+    // rest. The selected row, and a row hovered for a moment, are queried
+    // with players and rules if they lack them. Call each frame for the tab
+    // being shown.
+    void set_focus(std::vector<ServerEntry>& list, const std::vector<int>& visible,
+                   int selected, int hovered = -1);
+
+    // Client-side filters for each tab. Rows are only re-evaluated when the
+    // expression changes or their ServerInfo was replaced.
+    ServerFilter filter;
+    ServerFilter internet_filter;
+    void apply_filters();
+
+    // Results shared by both tabs; re-selecting a server or having it in both
+    // lists reuses one query while it is in flight or younger than the TTL.
+    QueryCache query_cache;
+    float cache_ttl = 5.0f; // seconds
+
+    // Servers that keep timing out are backed off exponentially and skipped
+    // by refreshes until their next probe is due (or forced).
+    NegativeCache negative_cache;
+
+    // Players/ping/map samples per server, appended as results arrive
+    // (at most one per server per minute). Not open unless the caller opens it.
+    HistoryStore history;
+
+    // Player name search across both tabs, keyed by ServerEntry::id.
+    // Rosters are re-indexed as each query result arrives.
+    PlayerIndex player_index;
+
+    // Row of ServerEntry::id `id` in `list` (servers or internet_servers),
+    // or -1. The id map is rebuilt only after the list was sorted or edited.
+    int row_of(const std::vector<ServerEntry>& list, uint32_t id) const;
+
+    // Rule/mutator index across both tabs, keyed by ServerEntry::id.
+    // Also answers the filters' rule[K]==word terms.
+    RuleIndex rule_index;
+
+    // Join/leave/team/score/free-slot events from successive results of
+    // servers that stayed online.
+    RosterEvents roster_events;
+
     // Master server list
     struct MasterServer {
         std::string host;
@@ -57,9 +147,33 @@ public:
     bool master_querying() const { return master_future_.valid(); }
     std::string master_status;
 
+    // Thin-client mode: while attached, the Internet tab is fed by a
+    // collector's result stream (see collector.h) instead of master queries
+    // and local scans. Results go through the same path as local queries.
+    std::string collector_address = "127.0.0.1:7780";
+    void attach_collector(const std::string& address);
+    void detach_collector();
+    bool collector_attached() const { return collector_.running(); }
+    std::string collector_status() const { return collector_.status(); }
+
     // UI settings
     int font_size_idx = 1; // 0=Small, 1=Normal, 2=Large, 3=Extra Large
 
 private:
+    void start_query(ServerEntry& se, bool force, QueryPriority priority,
+                     QueryProfile profile);
+    std::chrono::steady_clock::time_point last_plan_{};
+    uint32_t focus_selected_id_ = 0, focus_hovered_id_ = 0;
+    std::chrono::steady_clock::time_point hovered_since_{};
+    bool take_result(ServerEntry& se);
+
+    void poll_collector_results();
+    void poll_sweep_results();
+
     std::future<MasterQueryResult> master_future_;
+    std::future<std::vector<ServerInfo>> sweep_future_;
+    CollectorClient collector_;
+    uint32_t next_id_ = 1;
+    mutable std::unordered_map<uint32_t, int> favorite_rows_, internet_rows_;
+    size_t internet_details_pending_ = 0;
 };
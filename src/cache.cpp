@@ -0,0 +1,264 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+std::string QueryCache::key(const std::string& ip, uint16_t port, QueryProtocol protocol) {
+    std::string k = ip + ":" + std::to_string(port);
+    if (protocol != QueryProtocol::Native)
+        k.append("/").append(query_protocol_name(protocol));
+    return k;
+}
+
+void QueryCache::set_ttl(std::chrono::milliseconds ttl) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ttl_ = ttl;
+}
+
+std::chrono::milliseconds QueryCache::ttl() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ttl_;
+}
+
+// In flight, or completed within the TTL.
+bool QueryCache::fresh(const std::shared_future<ServerInfo>& f,
+                       std::chrono::steady_clock::time_point now) const {
+    if (!f.valid()) return false;
+    if (f.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready)
+        return true;
+    return now - f.get().queried_at < ttl_;
+}
+
+QueryCache::QueryCache(int workers) : max_workers_(std::max(1, workers)) {}
+
+QueryCache::~QueryCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_)
+        t.join();
+    // Nobody will run these; don't leave their futures broken
+    for (auto& [k, job] : queued_) {
+        ServerInfo info;
+        info.address = job.ip;
+        info.port = job.port;
+        info.status = "cancelled";
+        info.queried_at = std::chrono::steady_clock::now();
+        job.promise.set_value(std::move(info));
+    }
+}
+
+std::shared_future<ServerInfo> QueryCache::request(const std::string& ip, uint16_t port,
+                                                   bool force, const QueryOptions& opts,
+                                                   QueryPriority priority) {
+    auto now = std::chrono::steady_clock::now();
+    std::string k = key(ip, port, opts.protocol);
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto& entry = entries_[k];
+
+    bool in_flight = entry.valid() &&
+        entry.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready;
+    // A Detail result also answers a List request, not the other way round
+    uint8_t wanted = query_profile_sections(opts.profile);
+    bool covers = in_flight || (entry.valid() && (entry.get().sections & wanted) == wanted);
+    // A forced refresh still joins an in-flight query: it will be newer than
+    // anything a second query could return. One that already started with
+    // less detail is joined too; the caller asks again once it is done.
+    if (in_flight || (!force && covers && fresh(entry, now))) {
+        auto it = queued_.find(k);
+        if (it != queued_.end()) {
+            // Asked for more urgently than it was queued (e.g. an internet row
+            // that is also a favorite)
+            if (priority < it->second.requested) {
+                it->second.requested = priority;
+                requeue(k);
+            }
+            // Not started yet, so it can still fetch the extra sections and
+            // ping samples
+            if (opts.profile == QueryProfile::Detail)
+                it->second.opts.profile = QueryProfile::Detail;
+            it->second.opts.ping_samples = std::max(it->second.opts.ping_samples,
+                                                    opts.ping_samples);
+        }
+        return entry;
+    }
+
+    Job job;
+    job.ip = ip;
+    job.port = port;
+    job.opts = opts;
+    job.requested = priority;
+    job.current = focus_priority(k, priority);
+    entry = job.promise.get_future().share();
+    ready_[static_cast<int>(job.current)].push_back(k);
+    queued_[k] = std::move(job);
+
+    if (workers_.empty()) {
+        for (int i = 0; i < max_workers_; ++i)
+            workers_.emplace_back([this]() { worker(); });
+    }
+    lock.unlock();
+    cv_.notify_one();
+    return entry;
+}
+
+QueryPriority QueryCache::focus_priority(const std::string& key, QueryPriority requested) const {
+    QueryPriority p = requested;
+    if (key == focus_selected_) return QueryPriority::Selected;
+    if (focus_set_.count(key) && QueryPriority::Visible < p) p = QueryPriority::Visible;
+    return p;
+}
+
+// Move a queued job to the FIFO of its current focus priority.
+void QueryCache::requeue(const std::string& key) {
+    auto it = queued_.find(key);
+    if (it == queued_.end()) return;
+    QueryPriority p = focus_priority(key, it->second.requested);
+    if (p == it->second.current) return;
+    it->second.current = p;
+    ready_[static_cast<int>(p)].push_back(key);
+}
+
+void QueryCache::set_focus(const std::vector<std::string>& visible, const std::string& selected) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (visible == focus_visible_ && selected == focus_selected_) return;
+
+    std::vector<std::string> touched = focus_visible_;
+    touched.push_back(focus_selected_);
+    focus_visible_ = visible;
+    focus_set_.clear();
+    focus_set_.insert(visible.begin(), visible.end());
+    focus_selected_ = selected;
+
+    touched.insert(touched.end(), visible.begin(), visible.end());
+    touched.push_back(selected);
+    for (auto& k : touched)
+        requeue(k);
+}
+
+size_t QueryCache::queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queued_.size();
+}
+
+void QueryCache::worker() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stop_ || !queued_.empty(); });
+            if (stop_) return;
+            bool found = false;
+            for (int p = 0; p < PRIORITIES && !found; ++p) {
+                while (!ready_[p].empty() && !found) {
+                    std::string k = std::move(ready_[p].front());
+                    ready_[p].pop_front();
+                    auto it = queued_.find(k);
+                    if (it == queued_.end() || static_cast<int>(it->second.current) != p)
+                        continue; // stale: started, or moved to another priority
+                    job = std::move(it->second);
+                    queued_.erase(it);
+                    found = true;
+                }
+            }
+            if (!found) continue;
+        }
+        job.promise.set_value(query_server(job.ip, job.port, job.opts));
+    }
+}
+
+void QueryCache::prune() {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (now - last_prune_ < std::chrono::seconds(5)) return;
+    last_prune_ = now;
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        if (fresh(it->second, now))
+            ++it;
+        else
+            it = entries_.erase(it);
+    }
+}
+
+void NegativeCache::record(const std::string& key, bool answered,
+                           std::chrono::steady_clock::time_point completed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (answered) {
+        entries_.erase(key);
+        return;
+    }
+
+    auto& e = entries_[key];
+    if (completed <= e.last_result) return;
+    e.last_result = completed;
+    ++e.failures;
+
+    auto backoff = base_backoff * (1LL << std::min(e.failures - 1, 20));
+    if (backoff > max_backoff) backoff = max_backoff;
+    std::uniform_real_distribution<double> jitter(0.8, 1.2);
+    auto delay = std::chrono::duration_cast<std::chrono::seconds>(backoff * jitter(rng_));
+    e.next_probe = std::chrono::system_clock::now() + delay;
+}
+
+bool NegativeCache::presumed_offline(const std::string& key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    return it != entries_.end() && std::chrono::system_clock::now() < it->second.next_probe;
+}
+
+int NegativeCache::failures(const std::string& key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    return it == entries_.end() ? 0 : it->second.failures;
+}
+
+void NegativeCache::load(const std::string& path) {
+    std::ifstream f(path);
+    if (!f.is_open()) return;
+
+    json j;
+    try {
+        f >> j;
+    } catch (...) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    for (auto& entry : j.value("servers", json::array())) {
+        std::string key = entry.value("key", "");
+        int failures = entry.value("failures", 0);
+        if (key.empty() || failures <= 0) continue;
+        Entry e;
+        e.failures = failures;
+        e.next_probe = std::chrono::system_clock::time_point(
+            std::chrono::seconds(entry.value("next_probe", int64_t{0})));
+        entries_[key] = e;
+    }
+}
+
+void NegativeCache::save(const std::string& path) const {
+    json j;
+    j["servers"] = json::array();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [key, e] : entries_) {
+            j["servers"].push_back({
+                {"key", key},
+                {"failures", e.failures},
+                {"next_probe", std::chrono::duration_cast<std::chrono::seconds>(
+                    e.next_probe.time_since_epoch()).count()}
+            });
+        }
+    }
+
+    std::ofstream f(path);
+    if (f.is_open()) {
+        f << j.dump(2) << std::endl;
+    }
+}
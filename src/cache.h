@@ -0,0 +1,139 @@
+#pragma once
+
+#include "query.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Order in which queued queries run; lower first.
+enum class QueryPriority {
+    Selected,   // the server whose details are open
+    Visible,    // rows currently on screen
+    Favorite,
+    Background, // everything else (e.g. an internet scan)
+};
+
+// Query results shared between tabs, keyed by "ip:port" plus the protocol
+// when it isn't native (key()).
+//
+// request() hands out a shared future for a server. If a query for it is
+// already queued or in flight, callers join that query instead of sending
+// another one; if the last result completed less than ttl ago, it is
+// returned immediately. Each result is stored once here; the copies tabs
+// take share its players and rules (SharedSection).
+//
+// Queries run on a fixed pool of worker threads. Queued ones are taken by
+// priority, then in request order; set_focus() moves the rows the user is
+// looking at ahead of the rest while they wait.
+class QueryCache {
+public:
+    explicit QueryCache(int workers = 128);
+    ~QueryCache();
+
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+
+    std::shared_future<ServerInfo> request(const std::string& ip, uint16_t port,
+                                           bool force = false,
+                                           const QueryOptions& opts = {},
+                                           QueryPriority priority = QueryPriority::Background);
+
+    // Keys of the rows on screen and of the selected server (may be empty).
+    // Their queued queries run first; keys no longer in focus go back to
+    // the priority they were requested with. Cheap when nothing changed.
+    void set_focus(const std::vector<std::string>& visible, const std::string& selected);
+
+    // Queries waiting for a worker.
+    size_t queued() const;
+
+    void set_ttl(std::chrono::milliseconds ttl);
+    std::chrono::milliseconds ttl() const;
+
+    // Drop completed results older than the TTL. Cheap to call every frame;
+    // only scans the table every few seconds.
+    void prune();
+
+    // Cache key of a query. Also the key set_focus() expects. A server
+    // queried with another protocol answers differently (GameSpy teams,
+    // rule names), so those results are kept apart.
+    static std::string key(const std::string& ip, uint16_t port,
+                           QueryProtocol protocol = QueryProtocol::Native);
+
+private:
+    struct Job {
+        std::string ip;
+        uint16_t port = 0;
+        QueryOptions opts;
+        std::promise<ServerInfo> promise;
+        QueryPriority requested = QueryPriority::Background;
+        QueryPriority current = QueryPriority::Background;
+    };
+    static constexpr int PRIORITIES = 4;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_future<ServerInfo>> entries_;
+    std::chrono::milliseconds ttl_{5000};
+    std::chrono::steady_clock::time_point last_prune_{};
+
+    // Queued jobs by key. Each priority has a FIFO of keys; a key whose job
+    // has since moved to another priority (or started) is skipped when popped.
+    std::unordered_map<std::string, Job> queued_;
+    std::deque<std::string> ready_[PRIORITIES];
+    std::vector<std::string> focus_visible_;
+    std::unordered_set<std::string> focus_set_;
+    std::string focus_selected_;
+
+    int max_workers_;
+    std::vector<std::thread> workers_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+
+    bool fresh(const std::shared_future<ServerInfo>& f,
+               std::chrono::steady_clock::time_point now) const;
+    QueryPriority focus_priority(const std::string& key, QueryPriority requested) const;
+    void requeue(const std::string& key);
+    void worker();
+};
+
+// Servers that keep timing out. Each consecutive timeout doubles the wait
+// before the next probe (base, 2*base, 4*base ... capped at max_backoff, with
+// +/-20% jitter so a batch of dead servers doesn't come due together). Until
+// then the server is "presumed offline" and scans skip it unless forced.
+// Persisted so backoff survives restarts.
+class NegativeCache {
+public:
+    std::chrono::seconds base_backoff{30};
+    std::chrono::seconds max_backoff{3600};
+
+    // Record the outcome of a query completed at `completed`. A result
+    // already recorded (e.g. shared by both tabs) is ignored.
+    void record(const std::string& key, bool answered,
+                std::chrono::steady_clock::time_point completed);
+
+    bool presumed_offline(const std::string& key) const;
+    int failures(const std::string& key) const;
+
+    void load(const std::string& path);
+    void save(const std::string& path) const;
+
+private:
+    struct Entry {
+        int failures = 0;
+        std::chrono::system_clock::time_point next_probe{};
+        std::chrono::steady_clock::time_point last_result{};
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::mt19937 rng_{std::random_device{}()};
+};
@@ -0,0 +1,938 @@
+#include "cli.h"
+#include "cache.h"
+#include "collector.h"
+#include "events.h"
+#include "history.h"
+#include "jsonwriter.h"
+#include "master.h"
+#include "output.h"
+#include "pacer.h"
+#include "paths.h"
+#include "query.h"
+#include "resolver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static void print_help(const char* prog) {
+    std::fprintf(stderr,
+        "Usage: %s [OPTIONS]\n"
+        "\n"
+        "Options:\n"
+        "  --help                Show this help message and exit\n"
+        "  --query <servers>     Query servers and output JSON to stdout\n"
+        "                        <servers> is a comma-separated list of host:port\n"
+        "                        If port is omitted, 7777 is assumed\n"
+        "  --query-file <path>   Query the servers listed in <path> (one host:port per\n"
+        "                        line, '-' for stdin) and stream one JSON object per\n"
+        "                        line (NDJSON) as each query finishes\n"
+        "  --file <path>         Write JSON output to a file instead of stdout\n"
+        "                        (used with --query or --query-file)\n"
+        "  --protocol <p>        Query protocol: native (default), gamespy, or auto\n"
+        "                        (native with GameSpy fallback)\n"
+        "  --format <f>          Output format: json, ndjson, cbor or msgpack\n"
+        "                        (default json for --query, ndjson for --query-file)\n"
+        "  --intern              Replace map names, game types and rule keys with ids\n"
+        "                        defined once by {\"$def\": id, \"value\": ...} records\n"
+        "  --concurrency <n>     Servers queried at once (default 64)\n"
+        "  --timeout <ms>        Wait per reply before giving up (default 2000)\n"
+        "  --sweep               Send only the info query (reachability, ping, map and\n"
+        "                        player counts) to every server from one socket; with\n"
+        "                        --query, --query-file or --master\n"
+        "  --ping-samples <n>    Round trips measured per server for ping, min and\n"
+        "                        jitter (default 1)\n"
+        "  --rate <pps>          Query packets sent per second, in total (default 1000,\n"
+        "                        0 = unlimited); lowered automatically on packet loss\n"
+        "  --host-rate <pps>     Query packets per second to any one IP (default 20)\n"
+        "  --watch <s>           Re-query every <s> seconds and print, per server,\n"
+        "                        only what changed as NDJSON (with --query or\n"
+        "                        --query-file; runs until interrupted)\n"
+        "\n"
+        "Master server:\n"
+        "  --master <host:port>  List the servers registered with this master server\n"
+        "                        (NDJSON by default; port defaults to 28902)\n"
+        "  --gametype <class>    Only list this gametype, e.g. xCTFGame\n"
+        "  --scan                Query every listed server and stream the results\n"
+        "  --cdkey <path>        cdkey file (default: the GUI's cdkey)\n"
+        "\n"
+        "History:\n"
+        "  --history <server>    Export the recorded samples of host:port, or 'all',\n"
+        "                        as JSON (or NDJSON with --format ndjson)\n"
+        "  --since <hours>       How far back to export (default 24)\n"
+        "\n"
+        "Collector:\n"
+        "  --daemon              Keep the servers from --query-file and/or --master\n"
+        "                        refreshed and serve the results over HTTP\n"
+        "  --listen <addr>       host:port (default 127.0.0.1:7780) or unix:/path\n"
+        "  --master <host:port>  Also collect the servers listed by this master server\n"
+        "                        (with --gametype and --cdkey as above)\n"
+        "  --interval <s>        Seconds between refreshes (default 30)\n"
+        "\n"
+        "Examples:\n"
+        "  %s --query 192.168.1.1:7777,10.0.0.1,example.com:7778\n"
+        "  %s --query myserver.com\n"
+        "  %s --query myserver.com --file results.json\n"
+        "  %s --query-file servers.txt --concurrency 200 --timeout 1000\n"
+        "  %s --query-file - --format msgpack --intern < servers.txt\n"
+        "  %s --query-file servers.txt --watch 30\n"
+        "  %s --master utmaster.openspy.net:28902 --scan --concurrency 256 > census.ndjson\n"
+        "  %s --master utmaster.openspy.net:28902 --sweep > ranking.ndjson\n"
+        "  %s --daemon --master utmaster.openspy.net:28902 --listen unix:/tmp/utq\n"
+        "  %s --history myserver.com:7777 --since 168 --file week.json\n"
+        "\n"
+        "If no options are given, the GUI server browser is launched.\n",
+        prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog);
+}
+
+// Parse "host[:port]" (port defaults to 7777). Surrounding whitespace is ignored.
+static bool parse_target(const std::string& token, std::string& host, uint16_t& port) {
+    size_t begin = token.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return false;
+    size_t end = token.find_last_not_of(" \t\r\n");
+    std::string t = token.substr(begin, end - begin + 1);
+
+    port = 7777;
+    size_t colon = t.rfind(':');
+    if (colon != std::string::npos) {
+        host = t.substr(0, colon);
+        int p = std::atoi(t.substr(colon + 1).c_str());
+        if (p > 0 && p < 65536) port = static_cast<uint16_t>(p);
+    } else {
+        host = t;
+    }
+    return !host.empty();
+}
+
+struct Target {
+    std::string host;
+    uint16_t port = 7777;
+    size_t index = 0;        // position in the input
+    uint16_t query_port = 0; // as listed by a master server, 0 if unknown
+};
+
+// Query targets on `concurrency` worker threads. `next` is called under a
+// lock to fetch the next target (false when exhausted); `done` is called
+// under a second lock as each query finishes, in completion order.
+static void query_pool(int concurrency, const QueryOptions& opts,
+                       const std::function<bool(Target&)>& next,
+                       const std::function<void(const Target&, const ServerInfo&)>& done) {
+    std::mutex next_mutex, done_mutex;
+    auto worker = [&]() {
+        for (;;) {
+            Target t;
+            {
+                std::lock_guard<std::mutex> lock(next_mutex);
+                if (!next(t)) return;
+            }
+            QueryOptions target_opts = opts;
+            if (t.query_port) target_opts.query_port = t.query_port;
+            ServerInfo info = query_server(t.host, t.port, target_opts);
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done(t, info);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < concurrency; ++i)
+        workers.emplace_back(worker);
+    for (auto& w : workers)
+        w.join();
+}
+
+static FILE* open_output(const char* output_file) {
+    if (!output_file) {
+#ifdef _WIN32
+        // Binary formats must not get CRLF translation
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        return stdout;
+    }
+    FILE* fp = std::fopen(output_file, "wb");
+    if (!fp)
+        std::fprintf(stderr, "Error: could not open file '%s' for writing\n", output_file);
+    return fp;
+}
+
+struct OutputOptions {
+    const char* file = nullptr;
+    OutputFormat format = OutputFormat::Json;
+    bool intern = false;
+};
+
+// Parse a comma-separated server list
+static std::vector<Target> split_targets(const char* server_list) {
+    std::vector<Target> targets;
+    std::string input(server_list);
+    size_t pos = 0;
+    while (pos < input.size()) {
+        size_t comma = input.find(',', pos);
+        if (comma == std::string::npos) comma = input.size();
+        Target t;
+        if (parse_target(input.substr(pos, comma - pos), t.host, t.port)) {
+            t.index = targets.size();
+            targets.push_back(std::move(t));
+        }
+        pos = comma + 1;
+    }
+    return targets;
+}
+
+// Read every target of a file or stdin ("-"): one host:port per line, blank
+// lines and '#' comments skipped.
+static bool read_targets(const char* path, std::vector<Target>& targets) {
+    std::ifstream file;
+    std::istream* in = &std::cin;
+    if (std::string(path) != "-") {
+        file.open(path);
+        if (!file.is_open()) return false;
+        in = &file;
+    }
+    std::string line;
+    while (std::getline(*in, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+        Target t;
+        if (!parse_target(line, t.host, t.port)) continue;
+        t.index = targets.size();
+        targets.push_back(std::move(t));
+    }
+    return true;
+}
+
+static int run_query(const char* server_list, const OutputOptions& out,
+                     const QueryOptions& opts, int concurrency) {
+    std::vector<Target> targets = split_targets(server_list);
+    if (targets.empty()) {
+        std::fprintf(stderr, "Error: no valid servers specified\n");
+        return 1;
+    }
+
+    // Resolve every hostname in parallel up front instead of one by one
+    for (auto& t : targets)
+        dns_resolver().prefetch(t.host);
+
+    FILE* fp = open_output(out.file);
+    if (!fp) return 1;
+
+    // Query concurrently but write in command line order: a result that
+    // finishes early waits in `pending` until everything before it is out.
+    size_t bytes;
+    {
+        RecordWriter w(fp, out.format, out.intern);
+        w.begin();
+        std::map<size_t, ServerInfo> pending;
+        size_t next_idx = 0, next_write = 0;
+        query_pool(std::min<int>(concurrency, static_cast<int>(targets.size())), opts,
+            [&](Target& t) {
+                if (next_idx >= targets.size()) return false;
+                t = targets[next_idx++];
+                return true;
+            },
+            [&](const Target& t, const ServerInfo& info) {
+                pending.emplace(t.index, info);
+                for (auto it = pending.begin();
+                     it != pending.end() && it->first == next_write;
+                     it = pending.erase(it), ++next_write)
+                    w.write(it->second);
+            });
+        w.end();
+        bytes = w.bytes_written();
+    }
+
+    if (out.file) {
+        std::fclose(fp);
+        std::fprintf(stderr, "Wrote %zu bytes to %s\n", bytes, out.file);
+    }
+    return 0;
+}
+
+// Print the packet counters accumulated since `before`, under a scan summary.
+static void print_packet_stats(const QueryStats& before) {
+    QueryStats now = query_stats();
+    std::fprintf(stderr, "Packets: %llu sent, %llu received, %llu dropped by the kernel; "
+                         "%llu servers timed out, %llu socket errors, %llu unresolved\n",
+                 static_cast<unsigned long long>(now.sent - before.sent),
+                 static_cast<unsigned long long>(now.received - before.received),
+                 static_cast<unsigned long long>(now.dropped - before.dropped),
+                 static_cast<unsigned long long>(now.timed_out - before.timed_out),
+                 static_cast<unsigned long long>(now.socket_errors - before.socket_errors),
+                 static_cast<unsigned long long>(now.unresolved - before.unresolved));
+}
+
+// Stream targets from a file or stdin and write each result (by default as
+// one NDJSON line) as soon as it completes. Memory stays constant regardless of the
+// number of targets: only `concurrency` queries are held at a time.
+static int run_batch(const char* path, const OutputOptions& out,
+                     const QueryOptions& opts, int concurrency) {
+    std::ifstream file;
+    std::istream* in = &std::cin;
+    if (std::string(path) != "-") {
+        file.open(path);
+        if (!file.is_open()) {
+            std::fprintf(stderr, "Error: could not open file '%s'\n", path);
+            return 1;
+        }
+        in = &file;
+    }
+
+    FILE* fp = open_output(out.file);
+    if (!fp) return 1;
+
+    RecordWriter w(fp, out.format, out.intern);
+    w.begin();
+    auto start = std::chrono::steady_clock::now();
+    QueryStats stats = query_stats();
+    size_t read = 0, online = 0;
+    std::string line;
+    query_pool(concurrency, opts,
+        [&](Target& t) {
+            while (std::getline(*in, line)) {
+                // Blank lines and '#' comments are skipped
+                size_t first = line.find_first_not_of(" \t\r");
+                if (first == std::string::npos || line[first] == '#') continue;
+                if (!parse_target(line, t.host, t.port)) continue;
+                t.index = read++;
+                return true;
+            }
+            return false;
+        },
+        [&](const Target&, const ServerInfo& info) {
+            w.write(info);
+            w.flush();
+            if (info.online) ++online;
+        });
+
+    w.end();
+    if (out.file) std::fclose(fp);
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "Queried %zu servers (%zu online) in %.1f s\n", read, online, secs);
+    print_packet_stats(stats);
+    return 0;
+}
+
+// Ping-sweep `targets` (see sweep_servers()) and write each info-only
+// result as it arrives. Returns the number online.
+static size_t sweep_targets(const std::vector<Target>& targets, const QueryOptions& opts,
+                            RecordWriter& w) {
+    std::vector<SweepTarget> sweep;
+    sweep.reserve(targets.size());
+    for (auto& t : targets)
+        sweep.push_back({t.host, t.port, t.query_port});
+    size_t online = 0;
+    sweep_servers(sweep, opts, [&](size_t, const ServerInfo& info) {
+        w.write(info);
+        w.flush();
+        if (info.online) ++online;
+    });
+    return online;
+}
+
+// --sweep with --query or --query-file
+static int run_sweep(const std::vector<Target>& targets, const OutputOptions& out,
+                     const QueryOptions& opts) {
+    if (targets.empty()) {
+        std::fprintf(stderr, "Error: no valid servers specified\n");
+        return 1;
+    }
+    FILE* fp = open_output(out.file);
+    if (!fp) return 1;
+
+    auto start = std::chrono::steady_clock::now();
+    QueryStats stats = query_stats();
+    size_t bytes, online;
+    {
+        RecordWriter w(fp, out.format, out.intern);
+        w.begin();
+        online = sweep_targets(targets, opts, w);
+        w.end();
+        w.flush();
+        bytes = w.bytes_written();
+    }
+    if (out.file) {
+        std::fclose(fp);
+        std::fprintf(stderr, "Wrote %zu bytes to %s\n", bytes, out.file);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "Swept %zu servers (%zu online) in %.1f s\n", targets.size(), online, secs);
+    print_packet_stats(stats);
+    return 0;
+}
+
+struct MasterOptions {
+    std::string master;   // host[:port]
+    std::string gametype; // class name filter, empty for all
+    std::string cdkey_path;
+    bool scan = false;    // query every listed server
+    bool sweep = false;   // with scan: info query only (sweep_servers())
+};
+
+// Fetch the server list from a master server and write it, or with
+// opts.scan query every listed server and write each result as it completes.
+static int run_master(const MasterOptions& mopts, const OutputOptions& out,
+                      const QueryOptions& opts, int concurrency) {
+    std::string host = mopts.master;
+    uint16_t port = 28902;
+    size_t colon = host.rfind(':');
+    if (colon != std::string::npos) {
+        int p = std::atoi(host.c_str() + colon + 1);
+        if (p > 0 && p < 65536) port = static_cast<uint16_t>(p);
+        host.resize(colon);
+    }
+
+    std::string cdkey = read_cdkey(mopts.cdkey_path);
+    if (cdkey.empty()) {
+        std::fprintf(stderr, "Error: no cdkey (use --cdkey <path>)\n");
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    QueryStats stats = query_stats();
+    MasterQueryResult qr = query_master_server(host, port, cdkey, mopts.gametype);
+    if (!qr.error.empty()) {
+        std::fprintf(stderr, "Error: master server: %s\n", qr.error.c_str());
+        return 1;
+    }
+    double list_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "Master listed %zu servers in %.1f s\n", qr.servers.size(), list_secs);
+
+    FILE* fp = open_output(out.file);
+    if (!fp) return 1;
+
+    size_t bytes, online = 0;
+    {
+        RecordWriter w(fp, out.format, out.intern);
+        w.begin();
+        if (!mopts.scan) {
+            // The master's own view of each server, without querying it
+            for (auto& me : qr.servers) {
+                ServerInfo info;
+                info.address = me.ip;
+                info.port = me.port;
+                info.query_port = me.query_port;
+                info.name = me.name;
+                info.map_name = me.map_name;
+                info.gametype = me.game_type;
+                info.num_players = me.current_players;
+                info.max_players = me.max_players;
+                info.flags = me.flags;
+                info.online = true;
+                info.status = "listed";
+                w.write(info);
+            }
+        } else if (mopts.sweep) {
+            std::vector<Target> targets;
+            for (auto& me : qr.servers)
+                targets.push_back({me.ip, me.port, targets.size(), me.query_port});
+            online = sweep_targets(targets, opts, w);
+        } else {
+            size_t next_idx = 0;
+            query_pool(std::max(1, std::min<int>(concurrency, static_cast<int>(qr.servers.size()))), opts,
+                [&](Target& t) {
+                    if (next_idx >= qr.servers.size()) return false;
+                    auto& me = qr.servers[next_idx];
+                    t.host = me.ip;
+                    t.port = me.port;
+                    t.query_port = me.query_port;
+                    t.index = next_idx++;
+                    return true;
+                },
+                [&](const Target&, const ServerInfo& info) {
+                    w.write(info);
+                    w.flush();
+                    if (info.online) ++online;
+                });
+        }
+        w.end();
+        w.flush();
+        bytes = w.bytes_written();
+    }
+
+    if (out.file) {
+        std::fclose(fp);
+        std::fprintf(stderr, "Wrote %zu bytes to %s\n", bytes, out.file);
+    }
+    if (mopts.scan) {
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::fprintf(stderr, "Scanned %zu servers (%zu online) in %.1f s\n",
+                     qr.servers.size(), online, secs);
+        print_packet_stats(stats);
+    }
+    return 0;
+}
+
+// One --watch line for a server: the fields of `cur` that differ from
+// `prev` and its roster events. With no `prev` (first round) every field is
+// written, including players and variables, as the baseline to patch. A
+// server coming back online gets its players again: roster events are only
+// diffed between two online results, so they patch this new list.
+// Returns false, writing nothing, if nothing changed.
+static bool write_patch(JsonWriter& w, const std::string& key, int64_t time,
+                        const ServerInfo* prev, const ServerInfo& cur,
+                        const std::vector<RosterEvent>& events) {
+    bool online = !prev || prev->online != cur.online;
+    bool status = !prev || prev->status != cur.status;
+    bool name = !prev || prev->name != cur.name;
+    bool map = !prev || prev->map_name != cur.map_name || prev->map_title != cur.map_title;
+    bool gametype = !prev || prev->gametype != cur.gametype;
+    bool counts = !prev || prev->num_players != cur.num_players ||
+                  prev->max_players != cur.max_players;
+    bool variables = !prev || prev->variables != cur.variables;
+    if (!online && !status && !name && !map && !gametype && !counts && !variables &&
+        events.empty())
+        return false;
+
+    w.begin_object();
+    w.key("server").value(key);
+    w.key("time").value(time);
+    if (online) w.key("online").value(cur.online);
+    if (status) w.key("status").value(cur.status);
+    // Ping changes every round; only sent with the baseline and on coming online
+    if (online && cur.online) w.key("ping").value(cur.ping);
+    if (name) w.key("name").ut_string(cur.name);
+    if (map) {
+        w.key("map_name").ut_string(cur.map_name);
+        w.key("map_title").ut_string(cur.map_title);
+    }
+    if (gametype) w.key("gametype").ut_string(cur.gametype);
+    if (counts) {
+        w.key("num_players").value(cur.num_players);
+        w.key("max_players").value(cur.max_players);
+    }
+    if (!prev || (online && cur.online)) {
+        w.key("players").begin_array();
+        for (auto& p : cur.players) {
+            w.begin_object();
+            w.key("name").ut_string(p.name);
+            w.key("score").value(p.score);
+            w.key("team").value(p.team);
+            w.end_object();
+        }
+        w.end_array();
+    }
+    if (variables) {
+        w.key("variables").begin_array();
+        for (auto& [k, v] : cur.variables) {
+            w.begin_object();
+            w.key("key").ut_string(k);
+            w.key("value").ut_string(v);
+            w.end_object();
+        }
+        w.end_array();
+    }
+    if (!events.empty()) {
+        w.key("events").begin_array();
+        for (auto& e : events)
+            write_roster_event(w, e);
+        w.end_array();
+    }
+    w.end_object();
+    w.newline();
+    return true;
+}
+
+// Re-query `targets` every `interval` and write NDJSON patches (see
+// write_patch) as results come in. DNS, query port and parsed-reply caches
+// stay warm between rounds. Runs until interrupted.
+static int run_watch(const std::vector<Target>& targets, std::chrono::seconds interval,
+                     const char* file, const QueryOptions& opts, int concurrency) {
+    if (targets.empty()) {
+        std::fprintf(stderr, "Error: no valid servers specified\n");
+        return 1;
+    }
+    for (auto& t : targets)
+        dns_resolver().prefetch(t.host);
+
+    FILE* fp = open_output(file);
+    if (!fp) return 1;
+
+    JsonWriter w(fp);
+    RosterEvents roster;
+    std::vector<ServerInfo> last(targets.size());
+    std::vector<bool> seen(targets.size(), false);
+    for (;;) {
+        auto round_start = std::chrono::steady_clock::now();
+        size_t next_idx = 0, changed = 0;
+        query_pool(std::min<int>(concurrency, static_cast<int>(targets.size())), opts,
+            [&](Target& t) {
+                if (next_idx >= targets.size()) return false;
+                t = targets[next_idx++];
+                return true;
+            },
+            [&](const Target& t, const ServerInfo& info) {
+                std::string key = QueryCache::key(t.host, t.port);
+                ServerInfo& prev = last[t.index];
+                std::vector<RosterEvent> events;
+                if (seen[t.index] && prev.online && info.online) {
+                    uint64_t before = roster.seq();
+                    roster.diff(key, prev, info);
+                    events = roster.since(before);
+                }
+                auto now = std::chrono::system_clock::now().time_since_epoch();
+                int64_t time = std::chrono::duration_cast<std::chrono::seconds>(now).count();
+                if (write_patch(w, key, time, seen[t.index] ? &prev : nullptr, info, events)) {
+                    w.flush();
+                    std::fflush(fp);
+                    ++changed;
+                }
+                prev = info;
+                seen[t.index] = true;
+            });
+        double secs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - round_start).count();
+        std::fprintf(stderr, "Round: %zu of %zu servers changed (%.1f s)\n",
+                     changed, targets.size(), secs);
+        std::this_thread::sleep_until(round_start + interval);
+    }
+}
+
+// Export recorded history (see HistoryStore) as a JSON array or NDJSON, one
+// sample per record.
+static int run_history(const std::string& server, int hours, const char* file,
+                       OutputFormat format) {
+    if (format != OutputFormat::Json && format != OutputFormat::Ndjson) {
+        std::fprintf(stderr, "Error: --history supports --format json or ndjson\n");
+        return 1;
+    }
+
+    HistoryStore store;
+    std::string error;
+    if (!store.open_readonly(get_history_dir(), error)) {
+        std::fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::vector<std::string> keys;
+    if (server == "all") {
+        keys = store.servers();
+    } else {
+        std::string host;
+        uint16_t port;
+        if (!parse_target(server, host, port)) {
+            std::fprintf(stderr, "Error: invalid server '%s'\n", server.c_str());
+            return 1;
+        }
+        keys.push_back(QueryCache::key(host, port));
+    }
+
+    FILE* fp = open_output(file);
+    if (!fp) return 1;
+
+    bool ndjson = format == OutputFormat::Ndjson;
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    int64_t to = std::chrono::duration_cast<std::chrono::seconds>(now).count() + 1;
+    int64_t from = to - int64_t(hours) * 3600;
+    size_t count = 0;
+    size_t bytes;
+    {
+        JsonWriter w(fp, ndjson ? -1 : 2);
+        if (!ndjson) w.begin_array();
+        for (const auto& key : keys) {
+            store.scan(key, from, to, [&](const HistorySample& s) {
+                w.begin_object();
+                w.key("server").value(key);
+                w.key("time").value(s.time);
+                w.key("online").value(s.online);
+                w.key("ping").value(s.ping);
+                w.key("players").value(s.players);
+                w.key("max_players").value(s.max_players);
+                w.key("map").ut_string(store.map_name(s.map_id));
+                w.end_object();
+                if (ndjson) w.newline();
+                ++count;
+            });
+        }
+        if (!ndjson) {
+            w.end_array();
+            w.newline();
+        }
+        w.flush();
+        bytes = w.bytes_written();
+    }
+
+    if (file) {
+        std::fclose(fp);
+        std::fprintf(stderr, "Wrote %zu samples (%zu bytes) to %s\n", count, bytes, file);
+    }
+    return 0;
+}
+
+int run_cli(int argc, char** argv) {
+    const char* query_arg = nullptr;
+    const char* query_file_arg = nullptr;
+    const char* file_arg = nullptr;
+    const char* format_arg = nullptr;
+    bool intern = false;
+    bool daemon = false;
+    int watch_secs = 0;
+    bool scan = false;
+    bool sweep = false;
+    const char* history_arg = nullptr;
+    int since_hours = 24;
+    CollectorOptions collector;
+    QueryOptions query_opts;
+    int concurrency = 64;
+    bool show_help = false;
+    const char* not_for_daemon = nullptr; // last option --daemon would ignore
+    std::vector<std::string> given;       // options recognized, in order
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        for (const char* name : {"--query", "--file", "--protocol", "--format", "--intern",
+                                 "--scan", "--sweep", "--watch", "--history", "--concurrency",
+                                 "--timeout", "--ping-samples"})
+            if (arg == name) not_for_daemon = name;
+        if (arg == "--help" || arg == "-h") {
+            show_help = true;
+        } else if (arg == "--query" && i + 1 < argc) {
+            query_arg = argv[++i];
+        } else if (arg == "--query-file" && i + 1 < argc) {
+            query_file_arg = argv[++i];
+        } else if (arg == "--file" && i + 1 < argc) {
+            file_arg = argv[++i];
+        } else if (arg == "--protocol" && i + 1 < argc) {
+            if (!parse_query_protocol(argv[++i], query_opts.protocol)) {
+                std::fprintf(stderr, "Error: unknown protocol '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--format" && i + 1 < argc) {
+            format_arg = argv[++i];
+        } else if (arg == "--intern") {
+            intern = true;
+        } else if (arg == "--daemon") {
+            daemon = true;
+        } else if (arg == "--listen" && i + 1 < argc) {
+            collector.listen = argv[++i];
+        } else if (arg == "--master" && i + 1 < argc) {
+            collector.master = argv[++i];
+        } else if (arg == "--gametype" && i + 1 < argc) {
+            collector.gametype = argv[++i];
+        } else if (arg == "--cdkey" && i + 1 < argc) {
+            collector.cdkey_path = argv[++i];
+        } else if (arg == "--interval" && i + 1 < argc) {
+            int secs = std::atoi(argv[++i]);
+            if (secs < 1) {
+                std::fprintf(stderr, "Error: --interval must be a positive number of seconds\n");
+                return 1;
+            }
+            collector.interval = std::chrono::seconds(secs);
+        } else if (arg == "--scan") {
+            scan = true;
+        } else if (arg == "--sweep") {
+            sweep = true;
+        } else if (arg == "--watch" && i + 1 < argc) {
+            watch_secs = std::atoi(argv[++i]);
+            if (watch_secs < 1) {
+                std::fprintf(stderr, "Error: --watch must be a positive number of seconds\n");
+                return 1;
+            }
+        } else if (arg == "--history" && i + 1 < argc) {
+            history_arg = argv[++i];
+        } else if (arg == "--since" && i + 1 < argc) {
+            since_hours = std::atoi(argv[++i]);
+            if (since_hours < 1) {
+                std::fprintf(stderr, "Error: --since must be a positive number of hours\n");
+                return 1;
+            }
+        } else if (arg == "--concurrency" && i + 1 < argc) {
+            concurrency = std::atoi(argv[++i]);
+            if (concurrency < 1 || concurrency > 4096) {
+                std::fprintf(stderr, "Error: --concurrency must be between 1 and 4096\n");
+                return 1;
+            }
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            int ms = std::atoi(argv[++i]);
+            if (ms < 1) {
+                std::fprintf(stderr, "Error: --timeout must be a positive number of milliseconds\n");
+                return 1;
+            }
+            query_opts.timeout = std::chrono::milliseconds(ms);
+        } else if (arg == "--ping-samples" && i + 1 < argc) {
+            query_opts.ping_samples = std::atoi(argv[++i]);
+            if (query_opts.ping_samples < 1 || query_opts.ping_samples > 20) {
+                std::fprintf(stderr, "Error: --ping-samples must be between 1 and 20\n");
+                return 1;
+            }
+        } else if ((arg == "--rate" || arg == "--host-rate") && i + 1 < argc) {
+            double pps = std::atof(argv[++i]);
+            if (pps < 0) {
+                std::fprintf(stderr, "Error: %s must be a number of packets per second\n",
+                             arg.c_str());
+                return 1;
+            }
+            auto limits = send_pacer().limits();
+            (arg == "--rate" ? limits.packets_per_second : limits.per_host_per_second) = pps;
+            send_pacer().set_limits(limits);
+        } else {
+            continue;
+        }
+        given.push_back(arg);
+    }
+    if (show_help) {
+        print_help(argv[0]);
+        return 0;
+    }
+
+    // Options that only mean something in another mode would otherwise be
+    // ignored, or fall through to the GUI
+    auto has = [&](const char* name) {
+        return std::find(given.begin(), given.end(), name) != given.end();
+    };
+    bool querying = query_arg || query_file_arg;
+    struct Needs {
+        const char* option;
+        bool ok;
+        const char* needs;
+    };
+    for (const Needs& n : std::initializer_list<Needs>{
+             {"--scan", !collector.master.empty(), "--master"},
+             {"--gametype", !collector.master.empty(), "--master"},
+             {"--cdkey", !collector.master.empty(), "--master"},
+             {"--sweep", querying || !collector.master.empty(),
+              "--query, --query-file or --master"},
+             {"--listen", daemon, "--daemon"},
+             {"--interval", daemon, "--daemon"},
+             {"--since", history_arg != nullptr, "--history"},
+             {"--rate", querying || daemon || !collector.master.empty(),
+              "--query, --query-file, --master or --daemon"},
+             {"--host-rate", querying || daemon || !collector.master.empty(),
+              "--query, --query-file, --master or --daemon"},
+         }) {
+        if (!n.ok && has(n.option)) {
+            std::fprintf(stderr, "Error: %s requires %s\n", n.option, n.needs);
+            return 1;
+        }
+    }
+    if (sweep && watch_secs > 0) {
+        std::fprintf(stderr, "Error: --sweep can't be combined with --watch\n");
+        return 1;
+    }
+    if (daemon) {
+        // The collector queries like the GUI and serves every format itself
+        if (not_for_daemon) {
+            std::fprintf(stderr, "Error: %s can't be used with --daemon\n", not_for_daemon);
+            return 1;
+        }
+        if (query_file_arg) collector.targets_file = query_file_arg;
+        if (collector.cdkey_path.empty()) collector.cdkey_path = get_cdkey_path();
+        collector.history_dir = get_history_dir();
+        query_init();
+        int rc = run_collector(collector);
+        query_cleanup();
+        return rc;
+    }
+    if (history_arg) {
+        OutputFormat format = OutputFormat::Json;
+        if (format_arg && !parse_output_format(format_arg, format)) {
+            std::fprintf(stderr, "Error: unknown format '%s'\n", format_arg);
+            return 1;
+        }
+        return run_history(history_arg, since_hours, file_arg, format);
+    }
+    if (query_arg && query_file_arg) {
+        std::fprintf(stderr, "Error: use either --query or --query-file, not both\n");
+        return 1;
+    }
+    if (!collector.master.empty()) {
+        if (query_arg || query_file_arg) {
+            std::fprintf(stderr, "Error: use --master on its own, or with --daemon\n");
+            return 1;
+        }
+        MasterOptions mopts;
+        mopts.master = collector.master;
+        mopts.gametype = collector.gametype;
+        mopts.cdkey_path = collector.cdkey_path.empty() ? get_cdkey_path() : collector.cdkey_path;
+        mopts.scan = scan || sweep;
+        mopts.sweep = sweep;
+        OutputOptions out;
+        out.file = file_arg;
+        out.format = OutputFormat::Ndjson;
+        out.intern = intern;
+        if (format_arg && !parse_output_format(format_arg, out.format)) {
+            std::fprintf(stderr, "Error: unknown format '%s'\n", format_arg);
+            return 1;
+        }
+        query_init();
+        int rc = run_master(mopts, out, query_opts, concurrency);
+        query_cleanup();
+        return rc;
+    }
+    if (watch_secs > 0) {
+        if (!query_arg && !query_file_arg) {
+            std::fprintf(stderr, "Error: --watch requires --query or --query-file\n");
+            return 1;
+        }
+        if (format_arg && std::string(format_arg) != "ndjson") {
+            std::fprintf(stderr, "Error: --watch writes NDJSON only\n");
+            return 1;
+        }
+        std::vector<Target> targets;
+        if (query_arg) {
+            targets = split_targets(query_arg);
+        } else if (!read_targets(query_file_arg, targets)) {
+            std::fprintf(stderr, "Error: could not open file '%s'\n", query_file_arg);
+            return 1;
+        }
+        query_init();
+        int rc = run_watch(targets, std::chrono::seconds(watch_secs), file_arg,
+                           query_opts, concurrency);
+        query_cleanup();
+        return rc;
+    }
+    if (query_arg || query_file_arg) {
+        // --query defaults to a JSON array, --query-file to NDJSON
+        OutputOptions out;
+        out.file = file_arg;
+        out.format = query_arg ? OutputFormat::Json : OutputFormat::Ndjson;
+        out.intern = intern;
+        if (format_arg && !parse_output_format(format_arg, out.format)) {
+            std::fprintf(stderr, "Error: unknown format '%s'\n", format_arg);
+            return 1;
+        }
+
+        query_init();
+        int rc;
+        if (sweep) {
+            std::vector<Target> targets;
+            if (query_arg) {
+                targets = split_targets(query_arg);
+            } else if (!read_targets(query_file_arg, targets)) {
+                std::fprintf(stderr, "Error: could not open file '%s'\n", query_file_arg);
+                query_cleanup();
+                return 1;
+            }
+            rc = run_sweep(targets, out, query_opts);
+        } else {
+            rc = query_arg ? run_query(query_arg, out, query_opts, concurrency)
+                           : run_batch(query_file_arg, out, query_opts, concurrency);
+        }
+        query_cleanup();
+        return rc;
+    }
+    if (file_arg) {
+        std::fprintf(stderr, "Error: --file requires --query or --query-file\n");
+        print_help(argv[0]);
+        return 1;
+    }
+    // Any other option is for a mode that wasn't chosen; the GUI takes none
+    if (!given.empty()) {
+        std::fprintf(stderr, "Error: %s needs one of --query, --query-file, --master, "
+                             "--history or --daemon\n", given.front().c_str());
+        return 1;
+    }
+    return -1;
+}
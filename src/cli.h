@@ -0,0 +1,6 @@
+#pragma once
+
+// Command line mode (--query, --query-file ...). Returns the process exit
+// code, or -1 when no command line mode was requested and the GUI should
+// start.
+int run_cli(int argc, char** argv);
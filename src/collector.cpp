@@ -0,0 +1,744 @@
+#include "collector.h"
+#include "app.h"
+#include "output.h"
+#include "resolver.h"
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+using socket_t = SOCKET;
+static constexpr socket_t SOCKET_INVALID = INVALID_SOCKET;
+#else
+using socket_t = int;
+static constexpr socket_t SOCKET_INVALID = -1;
+#endif
+
+static void close_socket(socket_t s) {
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+static volatile std::sig_atomic_t g_stop = 0;
+
+static void on_signal(int) {
+    g_stop = 1;
+}
+
+// ---------------------------------------------------------------------------
+// Snapshot: latest result per server, stamped with a change sequence number
+// ---------------------------------------------------------------------------
+
+class Snapshot {
+public:
+    void publish(const ServerInfo& info) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& e = entries_[QueryCache::key(info.address, info.port)];
+        e.info = info;
+        e.seq = ++seq_;
+    }
+
+    // Records that changed after `since` (0 = all). `seq` receives the
+    // sequence number the body is current as of.
+    std::string render(OutputFormat format, bool intern, uint64_t since, uint64_t& seq) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        seq = seq_;
+
+        // Plain full snapshots are what dashboards poll; keep one per format
+        // until the next change.
+        bool cacheable = since == 0 && !intern;
+        auto& cached = cache_[static_cast<int>(format)];
+        if (cacheable && cached.seq == seq_ && !cached.body.empty())
+            return cached.body;
+
+        std::string body;
+        {
+            RecordWriter w(body, format, intern);
+            w.begin();
+            for (auto& [key, e] : entries_)
+                if (e.seq > since) w.write(e.info);
+            w.end();
+        }
+        if (cacheable) {
+            cached.body = body;
+            cached.seq = seq_;
+        }
+        return body;
+    }
+
+    // Records changed after `since` for /stream: each one a MessagePack
+    // object prefixed with its length as a 4-byte big-endian integer.
+    std::string frames(uint64_t since, uint64_t& seq) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        seq = seq_;
+        std::string out, record;
+        for (auto& [key, e] : entries_) {
+            if (e.seq <= since) continue;
+            record.clear();
+            {
+                RecordWriter w(record, OutputFormat::Msgpack);
+                w.write(e.info);
+            }
+            auto n = static_cast<uint32_t>(record.size());
+            char len[4] = {static_cast<char>(n >> 24), static_cast<char>(n >> 16),
+                           static_cast<char>(n >> 8), static_cast<char>(n)};
+            out.append(len, 4);
+            out.append(record);
+        }
+        return out;
+    }
+
+    uint64_t seq() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return seq_;
+    }
+
+    // Forget servers whose key isn't in `keys` (no longer listed). Bumps the
+    // sequence so cached snapshots are rebuilt; /updates and /stream clients
+    // see removals only by fetching a full /snapshot.
+    void retain(const std::unordered_set<std::string>& keys) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t before = entries_.size();
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (keys.count(it->first))
+                ++it;
+            else
+                it = entries_.erase(it);
+        }
+        if (entries_.size() != before) ++seq_;
+    }
+
+    void counts(size_t& servers, size_t& online, uint64_t& seq) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        servers = entries_.size();
+        online = 0;
+        for (auto& [key, e] : entries_)
+            if (e.info.online) ++online;
+        seq = seq_;
+    }
+
+private:
+    struct Entry {
+        ServerInfo info;
+        uint64_t seq = 0;
+    };
+    struct Cached {
+        std::string body;
+        uint64_t seq = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Entry> entries_; // "address:port", sorted for stable output
+    uint64_t seq_ = 0;
+    Cached cache_[4];
+};
+
+// ---------------------------------------------------------------------------
+// HTTP endpoint
+// ---------------------------------------------------------------------------
+
+// Value of `name` in a query string ("a=1&b=2"), or empty.
+static std::string query_param(const std::string& query, const std::string& name) {
+    size_t pos = 0;
+    while (pos < query.size()) {
+        size_t amp = query.find('&', pos);
+        if (amp == std::string::npos) amp = query.size();
+        std::string kv = query.substr(pos, amp - pos);
+        size_t eq = kv.find('=');
+        if (kv.substr(0, eq) == name)
+            return eq == std::string::npos ? "1" : kv.substr(eq + 1);
+        pos = amp + 1;
+    }
+    return {};
+}
+
+static const char* content_type(OutputFormat f) {
+    switch (f) {
+        case OutputFormat::Json:    return "application/json";
+        case OutputFormat::Ndjson:  return "application/x-ndjson";
+        case OutputFormat::Cbor:    return "application/cbor";
+        case OutputFormat::Msgpack: return "application/msgpack";
+    }
+    return "application/octet-stream";
+}
+
+// `seq_header` names the sequence `seq` belongs to (/events has its own).
+static std::string response(int code, const char* reason, const char* type,
+                            const std::string& body, uint64_t seq,
+                            const char* seq_header = "X-Seq") {
+    std::string head = "HTTP/1.0 " + std::to_string(code) + " " + reason + "\r\n"
+        "Content-Type: " + type + "\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n" +
+        seq_header + ": " + std::to_string(seq) + "\r\n"
+        "Connection: close\r\n\r\n";
+    return head + body;
+}
+
+// Whether a request head (up to the blank line) has arrived.
+static bool request_complete(const std::string& request) {
+    return request.find("\r\n\r\n") != std::string::npos ||
+           request.find("\n\n") != std::string::npos;
+}
+
+// Answer one request into `out`. Returns true for /stream, whose connection
+// stays open as a subscriber; `stream_seq` is then the sequence number
+// already queued.
+static bool handle_request(const std::string& request, Snapshot& snapshot,
+                           const RosterEvents& events, const std::string& master_status,
+                           bool accept_stream, std::string& out, uint64_t& stream_seq) {
+    // "GET /path?query HTTP/1.1"
+    size_t sp1 = request.find(' ');
+    size_t sp2 = sp1 == std::string::npos ? sp1 : request.find(' ', sp1 + 1);
+    if (sp2 == std::string::npos || request.compare(0, sp1, "GET") != 0) {
+        out = response(405, "Method Not Allowed", "text/plain", "GET only\n", 0);
+        return false;
+    }
+    std::string target = request.substr(sp1 + 1, sp2 - sp1 - 1);
+    size_t qmark = target.find('?');
+    std::string path = target.substr(0, qmark);
+    std::string query = qmark == std::string::npos ? "" : target.substr(qmark + 1);
+
+    if (path == "/status") {
+        size_t servers, online;
+        uint64_t seq;
+        snapshot.counts(servers, online, seq);
+        std::string body;
+        {
+            JsonWriter w(body);
+            w.begin_object();
+            w.key("seq").value(static_cast<int64_t>(seq));
+            w.key("servers").value(static_cast<int64_t>(servers));
+            w.key("online").value(static_cast<int64_t>(online));
+            w.key("master").value(master_status);
+            QueryStats stats = query_stats();
+            w.key("packets").begin_object();
+            w.key("sent").value(static_cast<int64_t>(stats.sent));
+            w.key("received").value(static_cast<int64_t>(stats.received));
+            w.key("dropped").value(static_cast<int64_t>(stats.dropped));
+            w.key("timed_out").value(static_cast<int64_t>(stats.timed_out));
+            w.key("socket_errors").value(static_cast<int64_t>(stats.socket_errors));
+            w.key("unresolved").value(static_cast<int64_t>(stats.unresolved));
+            w.end_object();
+            w.end_object();
+            w.newline();
+        }
+        out = response(200, "OK", "application/json", body, seq);
+        return false;
+    }
+
+    if (path == "/stream") {
+        if (!accept_stream) {
+            out = response(503, "Service Unavailable", "text/plain", "too many streams\n", 0);
+            return false;
+        }
+        std::string body = snapshot.frames(0, stream_seq);
+        out = "HTTP/1.0 200 OK\r\n"
+            "Content-Type: application/x-utquery-stream\r\n"
+            "X-Seq: " + std::to_string(stream_seq) + "\r\n\r\n" + body;
+        return true;
+    }
+
+    if (path == "/events") {
+        // Roster events after `since`, as a JSON array or NDJSON
+        std::string fmt = query_param(query, "format");
+        bool ndjson = fmt == "ndjson";
+        if (!fmt.empty() && !ndjson && fmt != "json") {
+            out = response(400, "Bad Request", "text/plain", "format must be json or ndjson\n", 0);
+            return false;
+        }
+        uint64_t since = std::strtoull(query_param(query, "since").c_str(), nullptr, 10);
+        uint64_t seq = events.seq();
+        std::string body;
+        {
+            JsonWriter w(body);
+            if (!ndjson) w.begin_array();
+            for (auto& e : events.since(since)) {
+                write_roster_event(w, e);
+                if (ndjson) w.newline();
+            }
+            if (!ndjson) {
+                w.end_array();
+                w.newline();
+            }
+        }
+        out = response(200, "OK", ndjson ? content_type(OutputFormat::Ndjson)
+                                         : content_type(OutputFormat::Json), body, seq,
+                       "X-Event-Seq");
+        return false;
+    }
+
+    if (path != "/" && path != "/snapshot" && path != "/updates") {
+        out = response(404, "Not Found", "text/plain", "unknown path\n", 0);
+        return false;
+    }
+
+    OutputFormat format = OutputFormat::Json;
+    std::string fmt = query_param(query, "format");
+    if (!fmt.empty() && !parse_output_format(fmt, format)) {
+        out = response(400, "Bad Request", "text/plain", "unknown format\n", 0);
+        return false;
+    }
+    bool intern = query_param(query, "intern") == "1";
+    uint64_t since = std::strtoull(query_param(query, "since").c_str(), nullptr, 10);
+
+    uint64_t seq;
+    std::string body = snapshot.render(format, intern, since, seq);
+    out = response(200, "OK", content_type(format), body, seq);
+    return false;
+}
+
+static void set_nonblocking(socket_t s) {
+#ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket(s, FIONBIO, &mode);
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    fcntl(s, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+static bool would_block() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static int poll_sockets(std::vector<pollfd>& fds, int timeout_ms) {
+#ifdef _WIN32
+    return WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeout_ms);
+#else
+    return poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout_ms);
+#endif
+}
+
+// The socket file a collector bound, so shutdown removes only its own.
+struct SocketFile {
+#ifndef _WIN32
+    dev_t dev = 0;
+    ino_t ino = 0;
+#endif
+};
+
+#ifndef _WIN32
+static bool same_socket_file(const std::string& path, const SocketFile& file) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) &&
+           st.st_dev == file.dev && st.st_ino == file.ino;
+}
+
+// Make `path` free to bind: remove a socket left behind by a collector that
+// is gone. Anything else there, or a socket still accepting connections,
+// is left alone and reported in `error`.
+static bool clear_socket_path(const std::string& path, const sockaddr_un& addr,
+                              std::string& error) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        if (errno == ENOENT) return true;
+        error = "can't use " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        error = path + " exists and is not a socket";
+        return false;
+    }
+    socket_t probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe == SOCKET_INVALID) {
+        error = "socket() failed";
+        return false;
+    }
+    bool live = connect(probe, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+    close_socket(probe);
+    if (live) {
+        error = "another collector is listening on " + path;
+        return false;
+    }
+    unlink(path.c_str());
+    return true;
+}
+#endif
+
+static socket_t open_listener(const std::string& listen_spec, SocketFile& bound,
+                              std::string& error) {
+    if (listen_spec.rfind("unix:", 0) == 0) {
+#ifdef _WIN32
+        (void)bound;
+        error = "unix sockets are not supported on Windows";
+        return SOCKET_INVALID;
+#else
+        std::string path = listen_spec.substr(5);
+        sockaddr_un addr{};
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            error = "invalid socket path";
+            return SOCKET_INVALID;
+        }
+        addr.sun_family = AF_UNIX;
+        std::copy(path.begin(), path.end(), addr.sun_path);
+        if (!clear_socket_path(path, addr, error)) return SOCKET_INVALID;
+        socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == SOCKET_INVALID) {
+            error = "socket() failed";
+            return SOCKET_INVALID;
+        }
+        struct stat st;
+        if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(s, 64) != 0 || lstat(path.c_str(), &st) != 0) {
+            error = "could not listen on " + path;
+            close_socket(s);
+            return SOCKET_INVALID;
+        }
+        bound.dev = st.st_dev;
+        bound.ino = st.st_ino;
+        return s;
+#endif
+    }
+
+    std::string host = listen_spec;
+    uint16_t port = 7780;
+    size_t colon = listen_spec.rfind(':');
+    if (colon != std::string::npos) {
+        host = listen_spec.substr(0, colon);
+        int p = std::atoi(listen_spec.substr(colon + 1).c_str());
+        if (p <= 0 || p > 65535) {
+            error = "invalid port in '" + listen_spec + "'";
+            return SOCKET_INVALID;
+        }
+        port = static_cast<uint16_t>(p);
+    }
+    std::string ip = dns_resolver().resolve(host.empty() ? "127.0.0.1" : host);
+    if (ip.empty()) {
+        error = "could not resolve '" + host + "'";
+        return SOCKET_INVALID;
+    }
+
+    socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == SOCKET_INVALID) {
+        error = "socket() failed";
+        return SOCKET_INVALID;
+    }
+    int yes = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof(yes));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+    if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(s, 64) != 0) {
+        error = "could not listen on " + ip + ":" + std::to_string(port);
+        close_socket(s);
+        return SOCKET_INVALID;
+    }
+    return s;
+}
+
+// ---------------------------------------------------------------------------
+// Collector loop
+// ---------------------------------------------------------------------------
+
+static bool load_targets(const std::string& path, App& app) {
+    std::ifstream file;
+    std::istream* in = &std::cin;
+    if (path != "-") {
+        file.open(path);
+        if (!file.is_open()) return false;
+        in = &file;
+    }
+    std::string line;
+    while (std::getline(*in, line)) {
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#') continue;
+        size_t end = line.find_last_not_of(" \t\r");
+        std::string t = line.substr(begin, end - begin + 1);
+
+        uint16_t port = 7777;
+        size_t colon = t.rfind(':');
+        if (colon != std::string::npos) {
+            int p = std::atoi(t.substr(colon + 1).c_str());
+            if (p > 0 && p < 65536) port = static_cast<uint16_t>(p);
+            t.resize(colon);
+        }
+        if (!t.empty()) app.add_server(t, port);
+    }
+    return true;
+}
+
+// Publish every entry whose query completed since the last pass.
+// Keyed by address:port, so a server in both lists (sharing one cached
+// query) or re-listed by a new master fetch is published once per result.
+static void publish_results(const std::vector<ServerEntry>& list, Snapshot& snapshot,
+                            std::unordered_map<std::string, std::chrono::steady_clock::time_point>& seen) {
+    for (auto& se : list) {
+        if (se.state != QueryState::Done) continue;
+        auto& last = seen[QueryCache::key(se.info.address, se.info.port)];
+        if (se.info.queried_at == last) continue;
+        last = se.info.queried_at;
+        snapshot.publish(se.info);
+    }
+}
+
+int run_collector(const CollectorOptions& opts) {
+    if (opts.targets_file.empty() && opts.master.empty()) {
+        std::fprintf(stderr, "Error: --daemon needs --query-file and/or --master\n");
+        return 1;
+    }
+
+    App app;
+    // Only share a result between the two lists, never across refreshes
+    app.cache_ttl = 1.0f;
+    // Clients get players and variables, and /events needs the rosters
+    app.internet_details = true;
+    if (!opts.targets_file.empty() && !load_targets(opts.targets_file, app)) {
+        std::fprintf(stderr, "Error: could not open file '%s'\n", opts.targets_file.c_str());
+        return 1;
+    }
+
+    std::string master_host = opts.master;
+    uint16_t master_port = 28902;
+    if (!opts.master.empty()) {
+        size_t colon = opts.master.rfind(':');
+        if (colon != std::string::npos) {
+            master_host = opts.master.substr(0, colon);
+            int p = std::atoi(opts.master.substr(colon + 1).c_str());
+            if (p > 0 && p < 65536) master_port = static_cast<uint16_t>(p);
+        }
+        app.load_cdkey(opts.cdkey_path);
+    }
+    if (!opts.history_dir.empty()) {
+        std::string err;
+        if (!app.history.open(opts.history_dir, err))
+            std::fprintf(stderr, "History disabled: %s\n", err.c_str());
+    }
+
+    std::string error;
+    SocketFile socket_file;
+    socket_t listener = open_listener(opts.listen, socket_file, error);
+    if (listener == SOCKET_INVALID) {
+        std::fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+    set_nonblocking(listener);
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+#ifndef _WIN32
+    std::signal(SIGPIPE, SIG_IGN); // a client hanging up mid-response
+#endif
+
+    std::fprintf(stderr, "collector: listening on %s, %zu servers, refresh every %llds\n",
+                 opts.listen.c_str(), app.servers.size(),
+                 static_cast<long long>(opts.interval.count()));
+
+    Snapshot snapshot;
+    std::mutex status_mutex;
+    std::string master_status;
+    std::atomic<bool> stop{false};
+
+    // One thread multiplexes every connection with non-blocking sockets, so
+    // a client that reads slowly only holds up itself. /stream clients stay
+    // connected and are sent new results as they are published.
+    std::thread server([&]() {
+        using clock = std::chrono::steady_clock;
+        struct Client {
+            socket_t sock;
+            std::string in;         // request head so far
+            std::string out;        // response bytes not sent yet
+            size_t sent = 0;
+            bool answered = false;  // close once `out` is sent, unless streaming
+            bool stream = false;    // /stream subscriber
+            uint64_t seq = 0;       // stream: sequence number already queued
+            clock::time_point deadline; // request must arrive, or a send progress, by then
+        };
+        std::vector<Client> clients;
+        constexpr size_t MAX_CLIENTS = 256;
+        constexpr size_t MAX_SUBSCRIBERS = 32;
+        constexpr auto REQUEST_TIMEOUT = std::chrono::seconds(2);
+        constexpr auto SEND_TIMEOUT = std::chrono::seconds(10);
+
+        std::vector<pollfd> fds;
+        while (!stop) {
+            fds.clear();
+            fds.push_back({listener, POLLIN, 0});
+            for (auto& c : clients) {
+                // Subscribers don't send anything after the request: readable
+                // means closed (or misbehaving)
+                short events = !c.answered || c.stream ? POLLIN : 0;
+                if (c.sent < c.out.size()) events |= POLLOUT;
+                fds.push_back({c.sock, events, 0});
+            }
+            if (poll_sockets(fds, 100) < 0) continue;
+
+            auto now = clock::now();
+            uint64_t current = snapshot.seq();
+            size_t streams = 0;
+            for (auto& c : clients)
+                if (c.stream) ++streams;
+
+            std::vector<Client> kept;
+            for (size_t i = 0; i < clients.size(); ++i) {
+                Client& c = clients[i];
+                short revents = fds[i + 1].revents;
+                bool ok = !(revents & (POLLERR | POLLNVAL));
+
+                if (ok && (revents & (POLLIN | POLLHUP))) {
+                    if (c.stream) {
+                        ok = false;
+                    } else if (!c.answered) {
+                        char buf[2048];
+                        int n = recv(c.sock, buf, sizeof(buf), 0);
+                        if (n > 0) {
+                            c.in.append(buf, static_cast<size_t>(n));
+                            ok = c.in.size() <= 16384;
+                        } else {
+                            ok = n < 0 && would_block();
+                        }
+                    }
+                }
+                if (ok && !c.answered && request_complete(c.in)) {
+                    std::string status;
+                    {
+                        std::lock_guard<std::mutex> lock(status_mutex);
+                        status = master_status;
+                    }
+                    c.stream = handle_request(c.in, snapshot, app.roster_events, status,
+                                              streams < MAX_SUBSCRIBERS, c.out, c.seq);
+                    if (c.stream) ++streams;
+                    c.answered = true;
+                    c.deadline = now + SEND_TIMEOUT;
+                }
+                if (ok && c.stream && c.sent == c.out.size() && c.seq < current) {
+                    c.out = snapshot.frames(c.seq, c.seq);
+                    c.sent = 0;
+                    c.deadline = now + SEND_TIMEOUT;
+                }
+                if (ok && c.sent < c.out.size()) {
+                    size_t chunk = std::min<size_t>(c.out.size() - c.sent, 1 << 20);
+                    int n = send(c.sock, c.out.data() + c.sent, static_cast<int>(chunk), 0);
+                    if (n > 0) {
+                        c.sent += static_cast<size_t>(n);
+                        c.deadline = now + SEND_TIMEOUT;
+                    } else {
+                        ok = n < 0 && would_block();
+                    }
+                }
+                // Done with a plain request; a subscriber or a reader that
+                // stopped making progress is dropped, not waited for
+                if (ok && c.answered && !c.stream && c.sent == c.out.size())
+                    ok = false;
+                if (ok && (!c.answered || c.sent < c.out.size()) && now > c.deadline)
+                    ok = false;
+
+                if (ok)
+                    kept.push_back(std::move(c));
+                else
+                    close_socket(c.sock);
+            }
+            clients.swap(kept);
+
+            if (!(fds[0].revents & POLLIN)) continue;
+            while (clients.size() < MAX_CLIENTS) {
+                socket_t client = accept(listener, nullptr, nullptr);
+                if (client == SOCKET_INVALID) break;
+                set_nonblocking(client);
+                Client c;
+                c.sock = client;
+                c.deadline = now + REQUEST_TIMEOUT;
+                clients.push_back(std::move(c));
+            }
+        }
+        for (auto& c : clients)
+            close_socket(c.sock);
+    });
+
+    using clock = std::chrono::steady_clock;
+    auto next_refresh = clock::now();
+    auto next_master = clock::now();
+    std::unordered_map<std::string, clock::time_point> seen;
+    bool master_pending = false;
+
+    while (!g_stop) {
+        auto now = clock::now();
+        if (!master_host.empty() && now >= next_master && !app.master_querying()) {
+            app.query_master(master_host, master_port, opts.gametype);
+            master_pending = app.master_querying();
+            next_master = now + opts.master_interval;
+        }
+        if (now >= next_refresh) {
+            app.refresh_all();
+            app.refresh_internet_all();
+            next_refresh = now + opts.interval;
+        }
+
+        app.poll_results();
+        if (master_pending && !app.master_querying()) {
+            // New master list: query it right away rather than at the next tick
+            master_pending = false;
+            app.refresh_internet_all();
+            std::fprintf(stderr, "collector: master: %s\n", app.master_status.c_str());
+            // Drop servers that left the list; a failed fetch keeps them
+            if (app.master_status.rfind("error", 0) != 0) {
+                std::unordered_set<std::string> listed;
+                for (auto* list : {&app.servers, &app.internet_servers})
+                    for (auto& se : *list)
+                        listed.insert(QueryCache::key(se.info.address, se.info.port));
+                snapshot.retain(listed);
+                for (auto it = seen.begin(); it != seen.end();) {
+                    if (listed.count(it->first))
+                        ++it;
+                    else
+                        it = seen.erase(it);
+                }
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(status_mutex);
+            master_status = app.master_status;
+        }
+
+        publish_results(app.servers, snapshot, seen);
+        publish_results(app.internet_servers, snapshot, seen);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    stop = true;
+    server.join();
+    close_socket(listener);
+#ifndef _WIN32
+    // Unless something else has taken the path since
+    if (opts.listen.rfind("unix:", 0) == 0 && same_socket_file(opts.listen.substr(5), socket_file))
+        unlink(opts.listen.substr(5).c_str());
+#endif
+    std::fprintf(stderr, "collector: stopped\n");
+    return 0;
+}
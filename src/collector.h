@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+struct CollectorOptions {
+    // "host:port" to serve HTTP on a (normally localhost) TCP port, or
+    // "unix:/path" for a Unix domain socket.
+    std::string listen = "127.0.0.1:7780";
+
+    std::string targets_file; // host:port per line ('-' for stdin), may be empty
+    std::string master;       // master server host[:port], empty for none
+    std::string gametype;     // master gametype filter (class name), empty for all
+    std::string cdkey_path;   // required for the master query
+    std::string history_dir;  // HistoryStore to record into, empty for none
+
+    std::chrono::seconds interval{30};         // server refresh
+    std::chrono::seconds master_interval{600}; // master list re-fetch
+};
+
+// Headless collector (--daemon). Keeps the target and/or master server set
+// refreshed with the same query engine as the GUI (App) and serves the latest
+// results over HTTP:
+//
+//   GET /snapshot[?format=json|ndjson|cbor|msgpack][&intern=1][&since=N]
+//   GET /updates?since=N   (same, only servers that changed after N)
+//   GET /status
+//   GET /events?since=N[&format=json|ndjson]   (player join/leave/team/score
+//                           and free-slot events after N, see RosterEvents)
+//   GET /stream            (stays open: every current server, then each new
+//                           result, as length-prefixed MessagePack records)
+//
+// Servers no longer listed by the master are dropped after each successful
+// master fetch. Connections are served without blocking on each other.
+// Every published result gets the next sequence number; responses carry the
+// current one in an X-Seq header for the client's next /updates request.
+// /events has its own sequence, sent as X-Event-Seq instead.
+// Runs until SIGINT/SIGTERM and returns the exit code.
+int run_collector(const CollectorOptions& opts);
@@ -0,0 +1,166 @@
+#include "events.h"
+#include "strutil.h"
+
+#include <algorithm>
+
+const char* roster_event_name(RosterEventType t) {
+    switch (t) {
+        case RosterEventType::Join:       return "join";
+        case RosterEventType::Leave:      return "leave";
+        case RosterEventType::TeamChange: return "team";
+        case RosterEventType::Score:      return "score";
+        case RosterEventType::SlotOpen:   return "slot_open";
+    }
+    return "join";
+}
+
+void write_roster_event(JsonWriter& w, const RosterEvent& e) {
+    w.begin_object();
+    w.key("seq").value(static_cast<int64_t>(e.seq));
+    w.key("time").value(e.time);
+    w.key("type").value(roster_event_name(e.type));
+    w.key("server").value(e.server);
+    w.key("server_name").ut_string(e.server_name);
+    if (e.type != RosterEventType::SlotOpen) {
+        w.key("player").ut_string(e.player);
+        w.key("team").value(e.team);
+        w.key("score").value(e.score);
+        if (e.type == RosterEventType::TeamChange) w.key("old_team").value(e.old_team);
+        if (e.type == RosterEventType::Score || e.type == RosterEventType::TeamChange)
+            w.key("old_score").value(e.old_score);
+    }
+    w.key("num_players").value(e.num_players);
+    w.key("max_players").value(e.max_players);
+    w.end_object();
+}
+
+void RosterEvents::diff(const std::string& key, const ServerInfo& before, const ServerInfo& after,
+                        bool rosters) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& last = diffed_[key];
+        if (last == after.queried_at) return;
+        last = after.queried_at;
+
+        // Drop servers that went away (evicted, removed favorites)
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_prune_ >= std::chrono::minutes(1)) {
+            last_prune_ = now;
+            for (auto it = diffed_.begin(); it != diffed_.end();) {
+                if (now - it->second > DIFFED_KEEP) it = diffed_.erase(it);
+                else ++it;
+            }
+        }
+    }
+
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    RosterEvent base;
+    base.time = std::chrono::duration_cast<std::chrono::seconds>(now).count();
+    base.server = key;
+    base.server_name = after.name;
+    base.num_players = after.num_players;
+    base.max_players = after.max_players;
+
+    std::vector<RosterEvent> events;
+    if (rosters) diff_players(base, before, after, events);
+
+    if (before.max_players > 0 && before.num_players >= before.max_players &&
+        after.num_players < after.max_players) {
+        RosterEvent e = base;
+        e.type = RosterEventType::SlotOpen;
+        events.push_back(std::move(e));
+    }
+
+    if (!events.empty()) push(events);
+}
+
+void RosterEvents::diff_players(const RosterEvent& base, const ServerInfo& before,
+                                const ServerInfo& after, std::vector<RosterEvent>& events) {
+    // Old players by folded name; each match takes the first unclaimed one
+    std::unordered_map<std::string, std::vector<size_t>> old_by_name;
+    for (size_t i = before.players.size(); i-- > 0;)
+        old_by_name[fold_ut_string(before.players[i].name)].push_back(i);
+    std::vector<bool> matched(before.players.size(), false);
+
+    std::string folded;
+    for (auto& p : after.players) {
+        fold_ut_string(p.name, folded);
+        auto it = old_by_name.find(folded);
+        if (it == old_by_name.end() || it->second.empty()) {
+            RosterEvent e = base;
+            e.type = RosterEventType::Join;
+            e.player = p.name;
+            e.team = p.team;
+            e.score = p.score;
+            events.push_back(std::move(e));
+            continue;
+        }
+        size_t i = it->second.back();
+        it->second.pop_back();
+        matched[i] = true;
+        auto& old = before.players[i];
+        if (old.team != p.team) {
+            RosterEvent e = base;
+            e.type = RosterEventType::TeamChange;
+            e.player = p.name;
+            e.team = p.team;
+            e.old_team = old.team;
+            e.score = p.score;
+            e.old_score = old.score;
+            events.push_back(std::move(e));
+        } else if (old.score != p.score) {
+            RosterEvent e = base;
+            e.type = RosterEventType::Score;
+            e.player = p.name;
+            e.team = e.old_team = p.team;
+            e.score = p.score;
+            e.old_score = old.score;
+            events.push_back(std::move(e));
+        }
+    }
+
+    for (size_t i = 0; i < before.players.size(); ++i) {
+        if (matched[i]) continue;
+        auto& old = before.players[i];
+        RosterEvent e = base;
+        e.type = RosterEventType::Leave;
+        e.player = old.name;
+        e.team = e.old_team = old.team;
+        e.score = e.old_score = old.score;
+        events.push_back(std::move(e));
+    }
+}
+
+void RosterEvents::push(std::vector<RosterEvent>& events) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& e : events) {
+        e.seq = ++seq_;
+        (e.type == RosterEventType::Score ? scores_ : ring_).push_back(std::move(e));
+    }
+    while (ring_.size() > capacity_) ring_.pop_front();
+    while (scores_.size() > score_capacity_) scores_.pop_front();
+}
+
+std::vector<RosterEvent> RosterEvents::since(uint64_t since, size_t max) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<RosterEvent> out;
+    if (since >= seq_) return out;
+    // Merge the two rings by seq
+    auto after = [since](const std::deque<RosterEvent>& ring) {
+        return std::upper_bound(ring.begin(), ring.end(), since,
+                                [](uint64_t s, const RosterEvent& e) { return s < e.seq; });
+    };
+    auto a = after(ring_), b = after(scores_);
+    while (out.size() < max && (a != ring_.end() || b != scores_.end())) {
+        if (b == scores_.end() || (a != ring_.end() && a->seq < b->seq))
+            out.push_back(*a++);
+        else
+            out.push_back(*b++);
+    }
+    return out;
+}
+
+uint64_t RosterEvents::seq() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return seq_;
+}
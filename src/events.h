@@ -0,0 +1,84 @@
+#pragma once
+
+#include "jsonwriter.h"
+#include "query.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class RosterEventType {
+    Join,
+    Leave,
+    TeamChange,
+    Score,
+    SlotOpen, // a full server has a free slot again
+};
+
+const char* roster_event_name(RosterEventType t);
+
+struct RosterEvent {
+    uint64_t seq = 0;
+    int64_t time = 0;      // unix seconds
+    RosterEventType type = RosterEventType::Join;
+    std::string server;    // QueryCache::key, "address:port"
+    std::string server_name;
+    std::string player;    // as sent (with color codes); empty for SlotOpen
+    int team = -1, old_team = -1;
+    int score = 0, old_score = 0;
+    int num_players = 0, max_players = 0;
+};
+
+// Write `e` as one JSON object: seq, time, type, server, server_name,
+// player/team/score (not for slot_open), old_team (team), old_score
+// (team, score), num_players, max_players.
+void write_roster_event(JsonWriter& w, const RosterEvent& e);
+
+// Join/leave/team/score events from comparing a server's previous and new
+// player list, kept in bounded ring buffers. Players are matched by name
+// (colors stripped, case folded); duplicate names pair up in list order.
+// Score events, one per scoring player per refresh, get a ring of their own
+// so they can't push joins, leaves and free slots out.
+//
+// Consumers remember the last seq they saw and ask for what came after it,
+// so nobody re-scans rosters to notice a change. Thread-safe: the collector
+// reads from its HTTP thread while results are diffed on the main loop.
+class RosterEvents {
+public:
+    explicit RosterEvents(size_t capacity = 4096, size_t score_capacity = 4096)
+        : capacity_(capacity), score_capacity_(score_capacity) {}
+
+    // Emit events for the change from `before` to `after` of server `key`.
+    // Player lists are compared only with `rosters`; a free slot needs just
+    // the player counts. A result (by queried_at) is only diffed once, even
+    // when it reaches two rows of the same server.
+    void diff(const std::string& key, const ServerInfo& before, const ServerInfo& after,
+              bool rosters = true);
+
+    // Events with seq > `since`, oldest first, at most `max`. Events the
+    // rings have already dropped are skipped.
+    std::vector<RosterEvent> since(uint64_t since, size_t max = SIZE_MAX) const;
+
+    // Seq of the newest event (0 if none yet).
+    uint64_t seq() const;
+
+private:
+    // Servers not diffed for this long are forgotten by diffed_
+    static constexpr std::chrono::minutes DIFFED_KEEP{15};
+
+    size_t capacity_, score_capacity_;
+    mutable std::mutex mutex_;
+    std::deque<RosterEvent> ring_, scores_; // each in seq order
+    uint64_t seq_ = 0;
+    // queried_at of the last result diffed per server
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> diffed_;
+    std::chrono::steady_clock::time_point last_prune_{};
+
+    static void diff_players(const RosterEvent& base, const ServerInfo& before,
+                             const ServerInfo& after, std::vector<RosterEvent>& events);
+    void push(std::vector<RosterEvent>& events);
+};
@@ -0,0 +1,434 @@
+#include "filter.h"
+#include "strutil.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+
+namespace {
+
+enum class Field {
+    Name, Map, Gametype, Status, Address,
+    Players, MaxPlayers, Ping, Flags,
+    Online, Full, Empty,
+    Rule,
+};
+
+enum class Op { Truthy, Eq, Ne, Lt, Le, Gt, Ge, Contains, NotContains };
+
+enum class Kind { And, Or, Not, Test, Text };
+
+bool is_text_field(Field f) {
+    return f == Field::Name || f == Field::Map || f == Field::Gametype ||
+           f == Field::Status || f == Field::Address || f == Field::Rule;
+}
+
+bool is_bool_field(Field f) {
+    return f == Field::Online || f == Field::Full || f == Field::Empty;
+}
+
+bool lookup_field(const std::string& ident, Field& out) {
+    static const struct { const char* name; Field field; } fields[] = {
+        {"name", Field::Name}, {"map", Field::Map}, {"gametype", Field::Gametype},
+        {"gt", Field::Gametype}, {"status", Field::Status}, {"address", Field::Address},
+        {"ip", Field::Address}, {"players", Field::Players}, {"max", Field::MaxPlayers},
+        {"maxplayers", Field::MaxPlayers}, {"ping", Field::Ping}, {"flags", Field::Flags},
+        {"online", Field::Online}, {"full", Field::Full}, {"empty", Field::Empty},
+    };
+    std::string lower = fold_ut_string(ident);
+    for (auto& f : fields) {
+        if (lower == f.name) {
+            out = f.field;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Case-insensitive ASCII equality; `lower` must already be folded.
+bool iequals(const std::string& s, const std::string& lower) {
+    if (s.size() != lower.size()) return false;
+    for (size_t i = 0; i < s.size(); ++i) {
+        char c = s[i];
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+        if (c != lower[i]) return false;
+    }
+    return true;
+}
+
+bool parse_number(const std::string& s, double& out) {
+    if (s.empty()) return false;
+    char* end = nullptr;
+    out = std::strtod(s.c_str(), &end);
+    return end && *end == '\0';
+}
+
+} // namespace
+
+struct ServerFilter::Node {
+    Kind kind = Kind::Test;
+    Field field = Field::Name;
+    Op op = Op::Truthy;
+    std::string text;       // folded literal
+    std::string rule_key;   // folded, Field::Rule only
+    double number = 0;
+    bool numeric = false;   // literal parsed as a number
+    std::unique_ptr<const Node> lhs, rhs;
+};
+
+namespace {
+
+using Node = ServerFilter::Node;
+
+class Parser {
+public:
+    explicit Parser(const std::string& s) : s_(s) {}
+
+    std::unique_ptr<const Node> parse(std::string& error) {
+        auto node = parse_or();
+        skip_ws();
+        if (!error_.empty()) {
+            error = error_;
+            return nullptr;
+        }
+        if (pos_ < s_.size()) {
+            error = "unexpected '" + s_.substr(pos_, 1) + "' at " + std::to_string(pos_ + 1);
+            return nullptr;
+        }
+        return node;
+    }
+
+private:
+    const std::string& s_;
+    size_t pos_ = 0;
+    std::string error_;
+
+    void fail(const std::string& msg) {
+        if (error_.empty()) error_ = msg;
+    }
+
+    void skip_ws() {
+        while (pos_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[pos_])))
+            ++pos_;
+    }
+
+    bool accept(const char* tok) {
+        skip_ws();
+        size_t n = std::char_traits<char>::length(tok);
+        if (s_.compare(pos_, n, tok) == 0) {
+            pos_ += n;
+            return true;
+        }
+        return false;
+    }
+
+    static std::unique_ptr<const Node> binary(Kind kind, std::unique_ptr<const Node> lhs,
+                                              std::unique_ptr<const Node> rhs) {
+        auto node = std::make_unique<Node>();
+        node->kind = kind;
+        node->lhs = std::move(lhs);
+        node->rhs = std::move(rhs);
+        return node;
+    }
+
+    std::unique_ptr<const Node> parse_or() {
+        auto lhs = parse_and();
+        while (error_.empty() && accept("||"))
+            lhs = binary(Kind::Or, std::move(lhs), parse_and());
+        return lhs;
+    }
+
+    std::unique_ptr<const Node> parse_and() {
+        auto lhs = parse_unary();
+        while (error_.empty() && accept("&&"))
+            lhs = binary(Kind::And, std::move(lhs), parse_unary());
+        return lhs;
+    }
+
+    std::unique_ptr<const Node> parse_unary() {
+        skip_ws();
+        // "!" but not the "!=" / "!~" operators (those only follow a field)
+        if (pos_ < s_.size() && s_[pos_] == '!') {
+            ++pos_;
+            auto node = std::make_unique<Node>();
+            node->kind = Kind::Not;
+            node->lhs = parse_unary();
+            return node;
+        }
+        if (accept("(")) {
+            auto node = parse_or();
+            if (!accept(")")) fail("missing ')'");
+            return node;
+        }
+        return parse_term();
+    }
+
+    // Quoted string or a bare word running up to whitespace/operator chars.
+    bool read_value(std::string& out, bool& quoted) {
+        skip_ws();
+        out.clear();
+        quoted = false;
+        if (pos_ < s_.size() && s_[pos_] == '"') {
+            quoted = true;
+            ++pos_;
+            while (pos_ < s_.size() && s_[pos_] != '"') {
+                if (s_[pos_] == '\\' && pos_ + 1 < s_.size()) ++pos_;
+                out.push_back(s_[pos_++]);
+            }
+            if (pos_ >= s_.size()) {
+                fail("unterminated string");
+                return false;
+            }
+            ++pos_;
+            return true;
+        }
+        while (pos_ < s_.size()) {
+            char c = s_[pos_];
+            if (std::isspace(static_cast<unsigned char>(c)) || c == '(' || c == ')' ||
+                c == '&' || c == '|' || c == '!' || c == '=' || c == '<' || c == '>' ||
+                c == '~' || c == '[' || c == ']')
+                break;
+            out.push_back(c);
+            ++pos_;
+        }
+        return !out.empty();
+    }
+
+    bool read_op(Op& op) {
+        skip_ws();
+        static const struct { const char* tok; Op op; } ops[] = {
+            {"==", Op::Eq}, {"!=", Op::Ne}, {"!~", Op::NotContains}, {"<=", Op::Le},
+            {">=", Op::Ge}, {"<", Op::Lt}, {">", Op::Gt}, {"=", Op::Eq}, {"~", Op::Contains},
+        };
+        for (auto& o : ops) {
+            if (accept(o.tok)) {
+                op = o.op;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::unique_ptr<const Node> parse_term() {
+        size_t start = pos_;
+        std::string word;
+        bool quoted = false;
+        if (!read_value(word, quoted)) {
+            fail(pos_ < s_.size() ? "unexpected '" + s_.substr(pos_, 1) + "'"
+                                  : "unexpected end of expression");
+            return nullptr;
+        }
+
+        auto node = std::make_unique<Node>();
+        Field field;
+        bool is_rule = !quoted && fold_ut_string(word) == "rule" && accept("[");
+        if (is_rule) {
+            field = Field::Rule;
+            skip_ws();
+            std::string key;
+            while (pos_ < s_.size() && s_[pos_] != ']')
+                key.push_back(s_[pos_++]);
+            if (!accept("]") || key.empty()) {
+                fail("expected rule[<key>]");
+                return nullptr;
+            }
+            node->rule_key = fold_ut_string(key);
+        } else if (quoted || !lookup_field(word, field)) {
+            // Free text: match against name/map/gametype
+            node->kind = Kind::Text;
+            node->text = fold_ut_string(word);
+            return node;
+        }
+        node->field = field;
+
+        Op op;
+        if (!read_op(op)) {
+            node->op = Op::Truthy;
+            return node;
+        }
+        node->op = op;
+
+        std::string value;
+        if (!read_value(value, quoted)) {
+            fail("expected a value after '" + s_.substr(start, pos_ - start) + "'");
+            return nullptr;
+        }
+        node->text = fold_ut_string(value);
+        node->numeric = !quoted && parse_number(value, node->number);
+
+        if (is_bool_field(field)) {
+            if (node->text == "true" || node->text == "yes") { node->number = 1; node->numeric = true; }
+            else if (node->text == "false" || node->text == "no") { node->number = 0; node->numeric = true; }
+            if (!node->numeric || (op != Op::Eq && op != Op::Ne))
+                fail("'" + word + "' only supports == / != true|false");
+        } else if (!is_text_field(field)) {
+            if (!node->numeric)
+                fail("'" + word + "' needs a numeric value");
+            else if (op == Op::Contains || op == Op::NotContains)
+                fail("'~' is only valid for text fields");
+        }
+        return node;
+    }
+};
+
+// Folded (color-stripped, lowercase) view of a string. Reuses a per-thread
+// buffer so evaluating thousands of rows doesn't allocate.
+const std::string& folded(const std::string& s) {
+    thread_local std::string buf;
+    fold_ut_string(s, buf);
+    return buf;
+}
+
+bool compare_text(const std::string& value, const Node& n, Op op) {
+    const std::string& v = folded(value);
+    switch (op) {
+        case Op::Truthy:      return !v.empty();
+        case Op::Eq:          return v == n.text;
+        case Op::Ne:          return v != n.text;
+        case Op::Contains:    return v.find(n.text) != std::string::npos;
+        case Op::NotContains: return v.find(n.text) == std::string::npos;
+        default: break;
+    }
+    // Relational: numeric when both sides are numbers (e.g. rule[TimeLimit]>=20)
+    double num;
+    int cmp;
+    if (n.numeric && parse_number(v, num))
+        cmp = num < n.number ? -1 : (num > n.number ? 1 : 0);
+    else
+        cmp = v.compare(n.text);
+    switch (op) {
+        case Op::Lt: return cmp < 0;
+        case Op::Le: return cmp <= 0;
+        case Op::Gt: return cmp > 0;
+        case Op::Ge: return cmp >= 0;
+        default:     return false;
+    }
+}
+
+bool compare_number(double v, const Node& n) {
+    switch (n.op) {
+        case Op::Truthy: return v != 0;
+        case Op::Eq:     return v == n.number;
+        case Op::Ne:     return v != n.number;
+        case Op::Lt:     return v < n.number;
+        case Op::Le:     return v <= n.number;
+        case Op::Gt:     return v > n.number;
+        case Op::Ge:     return v >= n.number;
+        default:         return false;
+    }
+}
+
+bool compare_text(const std::string& value, const Node& n) {
+    return compare_text(value, n, n.op);
+}
+
+struct EvalContext {
+    const ServerInfo& info;
+    uint32_t server_id;
+    const RuleIndex* rules; // null = scan ServerInfo::variables
+};
+
+// rule[K]==word holds when the value or any word in it equals `word`, which is
+// exactly what RuleIndex stores, so both paths agree.
+bool rule_value_equals(const std::string& value, const std::string& word) {
+    thread_local std::vector<std::string> tokens;
+    rule_value_tokens(folded(value), tokens);
+    return std::find(tokens.begin(), tokens.end(), word) != tokens.end();
+}
+
+bool eval_rule(const EvalContext& ctx, const Node& n) {
+    // Negated operators hold when no value with this key matches the positive form.
+    bool negated = (n.op == Op::Ne || n.op == Op::NotContains);
+    Op op = n.op == Op::Ne ? Op::Eq : (n.op == Op::NotContains ? Op::Contains : n.op);
+    bool any_key = (n.rule_key == "*");
+
+    bool found = false;
+    if (ctx.rules && (op == Op::Eq || op == Op::Truthy)) {
+        found = ctx.rules->contains(ctx.server_id, n.rule_key, op == Op::Eq ? n.text : "");
+    } else {
+        for (auto& [key, value] : ctx.info.variables) {
+            if (!any_key && !iequals(key, n.rule_key)) continue;
+            bool hit = op == Op::Truthy ||
+                       (op == Op::Eq ? rule_value_equals(value, n.text) : compare_text(value, n, op));
+            if (hit) {
+                found = true;
+                break;
+            }
+        }
+    }
+    return negated ? !found : found;
+}
+
+bool eval(const Node* n, const EvalContext& ctx) {
+    if (!n) return true;
+    const ServerInfo& info = ctx.info;
+    switch (n->kind) {
+        case Kind::And: return eval(n->lhs.get(), ctx) && eval(n->rhs.get(), ctx);
+        case Kind::Or:  return eval(n->lhs.get(), ctx) || eval(n->rhs.get(), ctx);
+        case Kind::Not: return !eval(n->lhs.get(), ctx);
+        case Kind::Text:
+            return folded(info.name).find(n->text) != std::string::npos ||
+                   folded(info.map_name).find(n->text) != std::string::npos ||
+                   folded(info.gametype).find(n->text) != std::string::npos;
+        case Kind::Test: break;
+    }
+
+    switch (n->field) {
+        case Field::Name:       return compare_text(info.name, *n);
+        case Field::Map:        return compare_text(info.map_name, *n);
+        case Field::Gametype:   return compare_text(info.gametype, *n);
+        case Field::Status:     return compare_text(info.status, *n);
+        case Field::Address:    return compare_text(info.address + ":" + std::to_string(info.port), *n);
+        case Field::Players:    return compare_number(info.num_players, *n);
+        case Field::MaxPlayers: return compare_number(info.max_players, *n);
+        case Field::Ping:       return compare_number(info.ping, *n);
+        case Field::Flags:      return compare_number(info.flags, *n);
+        case Field::Online:     return compare_number(info.online ? 1 : 0, *n);
+        case Field::Full:
+            return compare_number(info.max_players > 0 && info.num_players >= info.max_players ? 1 : 0, *n);
+        case Field::Empty:      return compare_number(info.num_players == 0 ? 1 : 0, *n);
+        case Field::Rule:       return eval_rule(ctx, *n);
+    }
+    return false;
+}
+
+bool has_rule_test(const Node* n) {
+    if (!n) return false;
+    if (n->kind == Kind::Test && n->field == Field::Rule) return true;
+    return has_rule_test(n->lhs.get()) || has_rule_test(n->rhs.get());
+}
+
+} // namespace
+
+uint32_t ServerFilter::next_generation() {
+    static std::atomic<uint32_t> counter{0};
+    return ++counter;
+}
+
+bool ServerFilter::compile(const std::string& expr) {
+    std::string err;
+    std::unique_ptr<const Node> root;
+    bool blank = expr.find_first_not_of(" \t\r\n") == std::string::npos;
+    if (!blank) {
+        root = Parser(expr).parse(err);
+        if (!root) {
+            error_ = err;
+            return false;
+        }
+    }
+    root_ = std::move(root);
+    uses_rules_ = has_rule_test(root_.get());
+    text_ = expr;
+    error_.clear();
+    generation_ = next_generation();
+    return true;
+}
+
+bool ServerFilter::matches(const ServerInfo& info) const {
+    return eval(root_.get(), {info, 0, nullptr});
+}
+
+bool ServerFilter::matches(const ServerInfo& info, uint32_t server_id, const RuleIndex& rules) const {
+    return eval(root_.get(), {info, server_id, &rules});
+}
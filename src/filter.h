@@ -0,0 +1,54 @@
+#pragma once
+
+#include "index.h"
+#include "query.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Client-side server list filter.
+//
+// An expression such as
+//   players>=4 && !full && map~"CTF-Face" && ping<80 && rule[Mutators]~"InstaGib"
+// is compiled once into a predicate tree and then evaluated per ServerInfo.
+//
+// Fields:    name map gametype status address players max ping flags
+//            online full empty rule[<key>] (rule[*] = any key)
+// Operators: == != < <= > >= ~ (substring) !~ && || ! ( )
+// Text comparisons ignore case and UT2004 color codes. A bare word or quoted
+// string without an operator matches against name, map and gametype.
+// rule[K]==word matches when the rule value or any word in it equals `word`.
+class ServerFilter {
+public:
+    struct Node;
+
+    // Compile an expression. On a syntax error returns false, sets error()
+    // and keeps the previously compiled predicate. Empty text matches all.
+    bool compile(const std::string& expr);
+
+    bool matches(const ServerInfo& info) const;
+
+    // Same, but rule[K]==word and rule[K] tests are answered from the rule
+    // index instead of scanning ServerInfo::variables.
+    bool matches(const ServerInfo& info, uint32_t server_id, const RuleIndex& rules) const;
+
+    bool empty() const { return !root_; }
+    // Has rule[...] terms, i.e. needs every server's rules to be queried.
+    bool uses_rules() const { return uses_rules_; }
+    const std::string& text() const { return text_; }
+    const std::string& error() const { return error_; }
+
+    // Changes on every successful compile. Rows remember the generation they
+    // were last evaluated against so only stale rows are re-evaluated.
+    uint32_t generation() const { return generation_; }
+
+private:
+    std::shared_ptr<const Node> root_;
+    bool uses_rules_ = false;
+    std::string text_;
+    std::string error_;
+    uint32_t generation_ = next_generation();
+
+    static uint32_t next_generation();
+};
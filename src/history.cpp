@@ -0,0 +1,484 @@
+#include "history.h"
+#include "strutil.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+// ---------------------------------------------------------------------------
+// File layout
+// ---------------------------------------------------------------------------
+
+static constexpr size_t BLOCK_SIZE = 4096;
+static constexpr size_t BLOCK_SAMPLES = 510; // (4096 - 16) / 8
+static constexpr char FILE_MAGIC[8] = {'U', 'T', 'Q', 'H', 'I', 'S', 'T', '1'};
+static constexpr uint16_t PING_OFFLINE = 0xFFFF;
+
+// Block 0 is the file header.
+struct FileHeader {
+    char magic[8];
+    uint32_t block_size;
+    uint32_t used_blocks; // including this one
+};
+
+// Every other block: one server's samples, column by column.
+struct Block {
+    uint16_t server_id; // low 16 bits of the server id
+    uint16_t count;
+    uint32_t base_time; // unix seconds of the first sample
+    uint32_t last_time; // unix seconds of the last sample
+    uint16_t server_id_high; // high 16 bits (was reserved, so 0 in older files)
+    uint16_t reserved;
+    uint16_t dt[BLOCK_SAMPLES]; // seconds since the previous sample (0 for the first)
+    uint16_t ping[BLOCK_SAMPLES];
+    uint16_t map[BLOCK_SAMPLES];
+    uint8_t players[BLOCK_SAMPLES];
+    uint8_t max_players[BLOCK_SAMPLES];
+};
+static_assert(sizeof(Block) == BLOCK_SIZE, "history block must be exactly 4 KB");
+
+static uint32_t block_server(const Block* b) {
+    return static_cast<uint32_t>(b->server_id_high) << 16 | b->server_id;
+}
+
+static constexpr uint32_t MAX_SERVERS = 0xFFFFFFFF;
+static constexpr uint32_t MAX_MAPS = 0xFFFF; // map ids are u16 columns
+
+// ---------------------------------------------------------------------------
+// Memory mapping
+// ---------------------------------------------------------------------------
+
+struct HistoryStore::Mapping {
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    bool writable = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    FileHeader* header() { return reinterpret_cast<FileHeader*>(data); }
+    const FileHeader* header() const { return reinterpret_cast<const FileHeader*>(data); }
+    Block* block(uint32_t i) { return reinterpret_cast<Block*>(data + size_t(i) * BLOCK_SIZE); }
+    const Block* block(uint32_t i) const {
+        return reinterpret_cast<const Block*>(data + size_t(i) * BLOCK_SIZE);
+    }
+
+    bool open(const std::string& path, bool write, std::string& error) {
+        writable = write;
+#ifdef _WIN32
+        // No sharing for writers doubles as the single-writer lock
+        file = CreateFileA(path.c_str(), write ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                           write ? FILE_SHARE_READ : (FILE_SHARE_READ | FILE_SHARE_WRITE),
+                           nullptr, write ? OPEN_ALWAYS : OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            error = write ? "history is in use by another process" : "no history recorded";
+            return false;
+        }
+        LARGE_INTEGER sz;
+        GetFileSizeEx(file, &sz);
+        size = static_cast<size_t>(sz.QuadPart);
+#else
+        fd = ::open(path.c_str(), write ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+        if (fd < 0) {
+            error = write ? "could not open " + path : "no history recorded";
+            return false;
+        }
+        if (write && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            error = "history is in use by another process";
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        struct stat st;
+        fstat(fd, &st);
+        size = static_cast<size_t>(st.st_size);
+#endif
+        if (size == 0) {
+            if (!write) {
+                error = "no history recorded";
+                return false;
+            }
+            if (!resize(BLOCK_SIZE * 256, error)) return false;
+            FileHeader* h = header();
+            std::memcpy(h->magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+            h->block_size = BLOCK_SIZE;
+            h->used_blocks = 1;
+            return true;
+        }
+        return map(error);
+    }
+
+    bool map(std::string& error) {
+        if (size < BLOCK_SIZE || size % BLOCK_SIZE != 0) {
+            error = "history file is damaged";
+            return false;
+        }
+#ifdef _WIN32
+        mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                     0, 0, nullptr);
+        if (mapping)
+            data = static_cast<uint8_t*>(MapViewOfFile(
+                mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+#else
+        void* p = mmap(nullptr, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                       MAP_SHARED, fd, 0);
+        data = p == MAP_FAILED ? nullptr : static_cast<uint8_t*>(p);
+#endif
+        if (!data) {
+            error = "could not map history file";
+            return false;
+        }
+        const FileHeader* h = header();
+        if (std::memcmp(h->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+            h->block_size != BLOCK_SIZE || h->used_blocks == 0 ||
+            size_t(h->used_blocks) * BLOCK_SIZE > size) {
+            error = "history file is damaged";
+            unmap();
+            return false;
+        }
+        return true;
+    }
+
+    void unmap() {
+        if (!data) return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+        mapping = nullptr;
+#else
+        munmap(data, size);
+#endif
+        data = nullptr;
+    }
+
+    // Read-only: map the file again if the writer grew it.
+    bool follow(std::string& error) {
+#ifdef _WIN32
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(file, &sz)) return false;
+        size_t current = static_cast<size_t>(sz.QuadPart);
+#else
+        struct stat st;
+        if (fstat(fd, &st) != 0) return false;
+        size_t current = static_cast<size_t>(st.st_size);
+#endif
+        if (current <= size) return true;
+        unmap();
+        size = current;
+        return map(error);
+    }
+
+    // Grow the file (new blocks read as zero) and map it again.
+    bool resize(size_t new_size, std::string& error) {
+        unmap();
+#ifdef _WIN32
+        LARGE_INTEGER sz;
+        sz.QuadPart = static_cast<LONGLONG>(new_size);
+        if (!SetFilePointerEx(file, sz, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+#else
+        if (ftruncate(fd, static_cast<off_t>(new_size)) != 0) {
+#endif
+            error = "could not grow history file";
+            return false;
+        }
+        size = new_size;
+        return map_raw(error);
+    }
+
+    // map() without the header check (used while creating the file).
+    bool map_raw(std::string& error) {
+#ifdef _WIN32
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+        if (mapping)
+            data = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0));
+#else
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        data = p == MAP_FAILED ? nullptr : static_cast<uint8_t*>(p);
+#endif
+        if (!data) error = "could not map history file";
+        return data != nullptr;
+    }
+
+    void close() {
+        unmap();
+#ifdef _WIN32
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (fd >= 0) ::close(fd); // also releases the lock
+        fd = -1;
+#endif
+    }
+};
+
+// ---------------------------------------------------------------------------
+// HistoryStore
+// ---------------------------------------------------------------------------
+
+HistoryStore::HistoryStore() : map_(new Mapping) {}
+
+HistoryStore::~HistoryStore() {
+    close();
+    delete map_;
+}
+
+bool HistoryStore::is_open() const {
+    return map_->data != nullptr;
+}
+
+void HistoryStore::close() {
+    map_->close();
+    server_keys_.clear();
+    server_ids_.clear();
+    map_names_.clear();
+    map_ids_.clear();
+    blocks_.clear();
+    indexed_blocks_ = 1;
+    servers_read_ = maps_read_ = 0;
+}
+
+// Append the complete lines of `path` past byte `offset` (advanced past
+// them); a line the writer is still writing is left for the next call.
+static void read_lines(const std::string& path, uint64_t& offset, uint32_t limit,
+                       std::vector<std::string>& names,
+                       std::unordered_map<std::string, uint32_t>& ids) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f.is_open()) return;
+    f.seekg(static_cast<std::streamoff>(offset));
+    std::string line;
+    while (names.size() < limit && std::getline(f, line) && !f.eof()) {
+        offset += line.size() + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        ids.emplace(line, static_cast<uint32_t>(names.size()));
+        names.push_back(line);
+    }
+}
+
+// Index blocks by server from their headers, from the first one not yet
+// indexed up to used_blocks.
+bool HistoryStore::index_blocks(std::string& error) {
+    blocks_.resize(server_keys_.size());
+    uint32_t used = map_->header()->used_blocks;
+    size_t mapped = map_->size / BLOCK_SIZE;
+    for (; indexed_blocks_ < used && indexed_blocks_ < mapped; ++indexed_blocks_) {
+        uint32_t server = block_server(map_->block(indexed_blocks_));
+        if (server >= blocks_.size()) {
+            // A reader can race a writer adding a new server; try again on
+            // the next refresh(), once servers.txt has its line
+            if (readonly_) return true;
+            error = "history file doesn't match servers.txt";
+            return false;
+        }
+        blocks_[server].push_back(indexed_blocks_);
+    }
+    return true;
+}
+
+bool HistoryStore::load(std::string& error) {
+    read_lines(dir_ + "/servers.txt", servers_read_, MAX_SERVERS, server_keys_, server_ids_);
+    read_lines(dir_ + "/maps.txt", maps_read_, MAX_MAPS, map_names_, map_ids_);
+    if (map_names_.empty()) {
+        uint32_t id;
+        intern("", map_names_, map_ids_, MAX_MAPS, "maps.txt", id); // id 0: unknown map
+    }
+    return index_blocks(error);
+}
+
+void HistoryStore::refresh() {
+    if (!is_open() || !readonly_) return;
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_refresh_ < std::chrono::seconds(1)) return;
+    last_refresh_ = now;
+
+    read_lines(dir_ + "/servers.txt", servers_read_, MAX_SERVERS, server_keys_, server_ids_);
+    read_lines(dir_ + "/maps.txt", maps_read_, MAX_MAPS, map_names_, map_ids_);
+    blocks_.resize(server_keys_.size());
+    std::string error;
+    if (!map_->follow(error)) {
+        // Replaced or damaged under us: start over
+        std::string dir = dir_;
+        if (!open_readonly(dir, error)) close();
+        return;
+    }
+    index_blocks(error);
+}
+
+bool HistoryStore::open(const std::string& dir, std::string& error) {
+    close();
+    dir_ = dir;
+    readonly_ = false;
+#ifdef _WIN32
+    CreateDirectoryA(dir.c_str(), nullptr);
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+    if (!map_->open(dir + "/samples.dat", true, error)) {
+        map_->close();
+        return false;
+    }
+    if (!load(error)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool HistoryStore::open_readonly(const std::string& dir, std::string& error) {
+    close();
+    dir_ = dir;
+    readonly_ = true;
+    if (!map_->open(dir + "/samples.dat", false, error)) {
+        map_->close();
+        return false;
+    }
+    if (!load(error)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool HistoryStore::intern(const std::string& s, std::vector<std::string>& names,
+                          std::unordered_map<std::string, uint32_t>& ids, uint32_t limit,
+                          const char* file, uint32_t& id) {
+    auto it = ids.find(s);
+    if (it != ids.end()) {
+        id = it->second;
+        return true;
+    }
+    if (names.size() >= limit || s.find('\n') != std::string::npos) return false;
+
+    std::ofstream f(dir_ + "/" + file, std::ios::app | std::ios::binary);
+    if (!f.is_open()) return false;
+    f << s << '\n';
+    id = static_cast<uint32_t>(names.size());
+    ids.emplace(s, id);
+    names.push_back(s);
+    return true;
+}
+
+uint32_t HistoryStore::new_block(uint32_t server_id, uint32_t base_time) {
+    FileHeader* h = map_->header();
+    uint32_t index = h->used_blocks;
+    if (size_t(index + 1) * BLOCK_SIZE > map_->size) {
+        // Grow by a quarter (at least 1 MB) so remaps stay rare
+        size_t blocks = map_->size / BLOCK_SIZE;
+        std::string error;
+        if (!map_->resize((blocks + std::max<size_t>(256, blocks / 4)) * BLOCK_SIZE, error))
+            return 0;
+        h = map_->header();
+    }
+    Block* b = map_->block(index);
+    std::memset(b, 0, BLOCK_SIZE);
+    b->server_id = static_cast<uint16_t>(server_id);
+    b->server_id_high = static_cast<uint16_t>(server_id >> 16);
+    b->base_time = base_time;
+    b->last_time = base_time;
+    h->used_blocks = index + 1;
+    blocks_[server_id].push_back(index);
+    indexed_blocks_ = index + 1;
+    return index;
+}
+
+bool HistoryStore::append(const std::string& key, int64_t t, const ServerInfo& info) {
+    if (!is_open() || readonly_ || t <= 0 || t > 0xFFFFFFFFLL) return false;
+
+    uint32_t server_id;
+    auto sit = server_ids_.find(key);
+    if (sit != server_ids_.end()) {
+        server_id = sit->second;
+    } else {
+        if (!intern(key, server_keys_, server_ids_, MAX_SERVERS, "servers.txt", server_id))
+            return false;
+        blocks_.resize(server_keys_.size());
+    }
+
+    auto time = static_cast<uint32_t>(t);
+    Block* b = nullptr;
+    if (!blocks_[server_id].empty()) {
+        b = map_->block(blocks_[server_id].back());
+        if (time < b->last_time + static_cast<uint64_t>(min_interval)) return false;
+        // Full, or the gap doesn't fit a 16-bit delta: start a new block
+        if (b->count >= BLOCK_SAMPLES || time - b->last_time > 0xFFFF) b = nullptr;
+    }
+    if (!b) {
+        uint32_t index = new_block(server_id, time);
+        if (!index) return false;
+        b = map_->block(index);
+    }
+
+    // Past 65535 distinct maps, new ones are recorded as unknown
+    uint32_t map_id = 0;
+    if (info.online)
+        intern(strip_ut_colors(info.map_name), map_names_, map_ids_, MAX_MAPS, "maps.txt", map_id);
+
+    uint16_t i = b->count;
+    b->dt[i] = static_cast<uint16_t>(i == 0 ? 0 : time - b->last_time);
+    b->ping[i] = info.online ? static_cast<uint16_t>(std::clamp(info.ping, 0, 0xFFFE)) : PING_OFFLINE;
+    b->map[i] = static_cast<uint16_t>(map_id);
+    b->players[i] = static_cast<uint8_t>(std::clamp(info.num_players, 0, 255));
+    b->max_players[i] = static_cast<uint8_t>(std::clamp(info.max_players, 0, 255));
+    b->last_time = time;
+    b->count = static_cast<uint16_t>(i + 1); // last, so a torn write is never counted
+    return true;
+}
+
+void HistoryStore::scan(const std::string& key, int64_t from, int64_t to,
+                        const std::function<void(const HistorySample&)>& fn) const {
+    auto sit = server_ids_.find(key);
+    if (sit == server_ids_.end() || sit->second >= blocks_.size() || !is_open()) return;
+
+    // Another process may still be appending (open_readonly): only trust
+    // blocks inside the mapped range.
+    size_t mapped_blocks = map_->size / BLOCK_SIZE;
+    for (uint32_t index : blocks_[sit->second]) {
+        if (index >= mapped_blocks) break;
+        const Block* b = map_->block(index);
+        if (b->count == 0 || b->last_time < from || b->base_time >= to) continue;
+
+        int64_t time = b->base_time;
+        uint16_t count = std::min<uint16_t>(b->count, BLOCK_SAMPLES);
+        for (uint16_t i = 0; i < count; ++i) {
+            time += b->dt[i];
+            if (time < from) continue;
+            if (time >= to) break;
+            HistorySample s;
+            s.time = time;
+            s.online = b->ping[i] != PING_OFFLINE;
+            s.ping = s.online ? b->ping[i] : 0;
+            s.players = b->players[i];
+            s.max_players = b->max_players[i];
+            s.map_id = b->map[i];
+            fn(s);
+        }
+    }
+}
+
+const std::string& HistoryStore::map_name(uint16_t id) const {
+    static const std::string unknown;
+    return id < map_names_.size() ? map_names_[id] : unknown;
+}
+
+size_t HistoryStore::sample_count() const {
+    if (!is_open()) return 0;
+    size_t n = 0;
+    uint32_t used = map_->header()->used_blocks;
+    for (uint32_t i = 1; i < used && size_t(i) * BLOCK_SIZE < map_->size; ++i)
+        n += map_->block(i)->count;
+    return n;
+}
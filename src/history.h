@@ -0,0 +1,92 @@
+#pragma once
+
+#include "query.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct HistorySample {
+    int64_t time = 0;   // unix seconds
+    bool online = false;
+    int ping = 0;       // ms (0 when offline)
+    int players = 0;
+    int max_players = 0;
+    uint16_t map_id = 0; // HistoryStore::map_name()
+};
+
+// Append-only per-server history of players, max players, ping, map and
+// online state.
+//
+// Samples live in one memory-mapped file of 4 KB blocks. Each block holds up
+// to 510 samples of a single server in columnar form: timestamps as u16
+// deltas from the previous sample, then ping, map id, players and max players
+// columns, 8 bytes per sample. Server keys and map names are interned in
+// servers.txt / maps.txt next to it. A range scan walks only the server's own
+// blocks and skips those outside the range from their header.
+//
+// One process appends at a time (the file is locked while open for writing);
+// others can open_readonly() to scan and export, and refresh() to follow
+// what the writer adds.
+class HistoryStore {
+public:
+    // At most one sample per server per this many seconds.
+    int64_t min_interval = 60;
+
+    HistoryStore();
+    ~HistoryStore();
+
+    HistoryStore(const HistoryStore&) = delete;
+    HistoryStore& operator=(const HistoryStore&) = delete;
+
+    // Open or create the store in `dir`. Returns false and sets `error` if
+    // it can't be opened (e.g. another process is recording).
+    bool open(const std::string& dir, std::string& error);
+    bool open_readonly(const std::string& dir, std::string& error);
+    void close();
+    bool is_open() const;
+
+    // Record `info` for server `key` ("address:port") at unix time `t`.
+    // Returns false if skipped (too soon after the last sample, read-only).
+    bool append(const std::string& key, int64_t t, const ServerInfo& info);
+
+    // Read-only: pick up servers, maps and blocks the writer added since
+    // the last call (remapping a grown file). Cheap to call every frame;
+    // looks at most once a second. Does nothing for the writer.
+    void refresh();
+
+    // Call `fn` for each sample of `key` with from <= time < to, oldest first.
+    void scan(const std::string& key, int64_t from, int64_t to,
+              const std::function<void(const HistorySample&)>& fn) const;
+
+    const std::string& map_name(uint16_t id) const;
+    std::vector<std::string> servers() const { return server_keys_; }
+
+    size_t sample_count() const;
+
+private:
+    struct Mapping;
+
+    Mapping* map_;
+    bool readonly_ = false;
+    std::string dir_;
+
+    std::vector<std::string> server_keys_;
+    std::unordered_map<std::string, uint32_t> server_ids_;
+    std::vector<std::string> map_names_;
+    std::unordered_map<std::string, uint32_t> map_ids_;
+    std::vector<std::vector<uint32_t>> blocks_; // block indices per server id
+    uint32_t indexed_blocks_ = 1;               // blocks_ covers blocks below this
+    uint64_t servers_read_ = 0, maps_read_ = 0; // bytes of the .txt files loaded
+    std::chrono::steady_clock::time_point last_refresh_{};
+
+    bool intern(const std::string& s, std::vector<std::string>& names,
+                std::unordered_map<std::string, uint32_t>& ids, uint32_t limit,
+                const char* file, uint32_t& id);
+    bool load(std::string& error);
+    bool index_blocks(std::string& error);
+    uint32_t new_block(uint32_t server_id, uint32_t base_time);
+};
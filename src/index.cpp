@@ -0,0 +1,335 @@
+#include "index.h"
+#include "strutil.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+
+static uint32_t trigram(const std::string& s, size_t i) {
+    return (static_cast<uint32_t>(static_cast<unsigned char>(s[i])) << 16) |
+           (static_cast<uint32_t>(static_cast<unsigned char>(s[i + 1])) << 8) |
+           static_cast<uint32_t>(static_cast<unsigned char>(s[i + 2]));
+}
+
+static void collect_grams(const std::string& s, std::vector<uint32_t>& out) {
+    for (size_t i = 0; i + 3 <= s.size(); ++i)
+        out.push_back(trigram(s, i));
+}
+
+static void sort_unique(std::vector<uint32_t>& v) {
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+void PlayerIndex::link(uint32_t server_id, const std::vector<uint32_t>& grams) {
+    for (uint32_t g : grams) {
+        auto& list = postings_[g];
+        auto it = std::lower_bound(list.begin(), list.end(), server_id);
+        if (it == list.end() || *it != server_id)
+            list.insert(it, server_id);
+    }
+}
+
+void PlayerIndex::unlink(uint32_t server_id, const std::vector<uint32_t>& grams) {
+    for (uint32_t g : grams) {
+        auto pit = postings_.find(g);
+        if (pit == postings_.end()) continue;
+        auto& list = pit->second;
+        auto it = std::lower_bound(list.begin(), list.end(), server_id);
+        if (it != list.end() && *it == server_id)
+            list.erase(it);
+        if (list.empty())
+            postings_.erase(pit);
+    }
+}
+
+void PlayerIndex::update(uint32_t server_id, const std::vector<PlayerInfo>& players) {
+    if (players.empty()) {
+        remove(server_id);
+        return;
+    }
+
+    auto it = servers_.find(server_id);
+    if (it != servers_.end() && it->second.names.size() == players.size() &&
+        std::equal(players.begin(), players.end(), it->second.names.begin(),
+                   [](const PlayerInfo& p, const std::string& n) { return p.name == n; }))
+        return;
+    ++generation_;
+
+    Roster roster;
+    roster.names.reserve(players.size());
+    roster.folded.reserve(players.size());
+    for (auto& p : players) {
+        roster.names.push_back(p.name);
+        roster.folded.push_back(fold_ut_string(p.name));
+        collect_grams(roster.folded.back(), roster.grams);
+    }
+    sort_unique(roster.grams);
+
+    if (it == servers_.end()) {
+        link(server_id, roster.grams);
+        servers_.emplace(server_id, std::move(roster));
+        return;
+    }
+
+    // Only touch posting lists for trigrams that changed
+    auto& old = it->second.grams;
+    std::vector<uint32_t> removed, added;
+    std::set_difference(old.begin(), old.end(), roster.grams.begin(), roster.grams.end(),
+                        std::back_inserter(removed));
+    std::set_difference(roster.grams.begin(), roster.grams.end(), old.begin(), old.end(),
+                        std::back_inserter(added));
+    unlink(server_id, removed);
+    link(server_id, added);
+    it->second = std::move(roster);
+}
+
+void PlayerIndex::remove(uint32_t server_id) {
+    auto it = servers_.find(server_id);
+    if (it == servers_.end()) return;
+    ++generation_;
+    unlink(server_id, it->second.grams);
+    servers_.erase(it);
+}
+
+void PlayerIndex::clear() {
+    ++generation_;
+    servers_.clear();
+    postings_.clear();
+}
+
+std::vector<PlayerIndex::Hit> PlayerIndex::find(const std::string& query, size_t limit,
+                                                const std::function<bool(uint32_t)>& accept) const {
+    std::vector<Hit> hits;
+    std::string needle = fold_ut_string(query);
+    if (needle.empty()) return hits;
+
+    auto scan = [&](uint32_t id, const Roster& r) {
+        if (accept && !accept(id)) return;
+        for (size_t i = 0; i < r.folded.size() && hits.size() < limit; ++i) {
+            if (r.folded[i].find(needle) != std::string::npos)
+                hits.push_back({id, r.names[i]});
+        }
+    };
+
+    // Too short for trigrams: scan every roster
+    if (needle.size() < 3) {
+        for (auto& [id, r] : servers_) {
+            if (hits.size() >= limit) break;
+            scan(id, r);
+        }
+        return hits;
+    }
+
+    std::vector<uint32_t> grams;
+    collect_grams(needle, grams);
+    sort_unique(grams);
+
+    std::vector<const std::vector<uint32_t>*> lists;
+    for (uint32_t g : grams) {
+        auto it = postings_.find(g);
+        if (it == postings_.end()) return hits; // some trigram appears nowhere
+        lists.push_back(&it->second);
+    }
+    std::sort(lists.begin(), lists.end(),
+        [](auto* a, auto* b) { return a->size() < b->size(); });
+
+    // Intersect starting from the shortest posting list
+    std::vector<uint32_t> candidates = *lists[0];
+    std::vector<uint32_t> tmp;
+    for (size_t i = 1; i < lists.size() && !candidates.empty(); ++i) {
+        tmp.clear();
+        std::set_intersection(candidates.begin(), candidates.end(),
+                              lists[i]->begin(), lists[i]->end(), std::back_inserter(tmp));
+        candidates.swap(tmp);
+    }
+
+    for (uint32_t id : candidates) {
+        if (hits.size() >= limit) break;
+        auto it = servers_.find(id);
+        if (it != servers_.end())
+            scan(id, it->second);
+    }
+    return hits;
+}
+
+void rule_value_tokens(const std::string& folded_value, std::vector<std::string>& out) {
+    out.clear();
+    if (folded_value.empty()) return;
+    out.push_back(folded_value);
+    std::string word;
+    for (size_t i = 0; i <= folded_value.size(); ++i) {
+        unsigned char c = i < folded_value.size() ? static_cast<unsigned char>(folded_value[i]) : 0;
+        if (std::isalnum(c) || c == '_' || c >= 0x80) {
+            word.push_back(static_cast<char>(c));
+        } else if (!word.empty()) {
+            if (word != folded_value) out.push_back(word);
+            word.clear();
+        }
+    }
+}
+
+static uint64_t make_term(uint32_t key, uint32_t token) {
+    return (static_cast<uint64_t>(key) << 32) | token;
+}
+
+uint32_t RuleIndex::intern(const std::string& s) {
+    // Id 0 is reserved for the wildcard key and the empty token
+    if (s.empty() || s == "*") return ANY_KEY;
+    auto it = strings_.find(s);
+    if (it != strings_.end()) return it->second;
+    uint32_t id;
+    if (!free_ids_.empty()) {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+    } else {
+        if (interned_.empty()) interned_.emplace_back();
+        id = static_cast<uint32_t>(interned_.size());
+        interned_.emplace_back();
+    }
+    interned_[id].text = s;
+    strings_.emplace(s, id);
+    return id;
+}
+
+// A posting list for `term` was created (+1) or dropped (-1). Strings no
+// term refers to any more are forgotten and their ids reused.
+void RuleIndex::ref_term(uint64_t term, int delta) {
+    for (uint32_t id : {static_cast<uint32_t>(term >> 32), static_cast<uint32_t>(term)}) {
+        if (id == ANY_KEY) continue;
+        auto& entry = interned_[id];
+        entry.refs += delta;
+        if (entry.refs == 0) {
+            strings_.erase(entry.text);
+            std::string().swap(entry.text);
+            free_ids_.push_back(id);
+        }
+    }
+}
+
+bool RuleIndex::lookup_term(const std::string& key, const std::string& token, uint64_t& term) const {
+    auto id_of = [this](const std::string& s, uint32_t& out) {
+        std::string f = fold_ut_string(s);
+        if (f.empty() || f == "*") {
+            out = ANY_KEY;
+            return true;
+        }
+        auto it = strings_.find(f);
+        if (it == strings_.end()) return false;
+        out = it->second;
+        return true;
+    };
+    uint32_t k, t;
+    if (!id_of(key, k) || !id_of(token, t)) return false;
+    term = make_term(k, t);
+    return true;
+}
+
+const std::vector<uint32_t>* RuleIndex::postings(const std::string& key, const std::string& token) const {
+    uint64_t term;
+    if (!lookup_term(key, token, term)) return nullptr;
+    auto it = postings_.find(term);
+    return it == postings_.end() ? nullptr : &it->second;
+}
+
+void RuleIndex::update(uint32_t server_id, const std::multimap<std::string, std::string>& variables) {
+    std::vector<uint64_t> terms;
+    std::vector<std::string> tokens;
+    for (auto& [key, value] : variables) {
+        uint32_t k = intern(fold_ut_string(key));
+        if (k == ANY_KEY) continue;
+        terms.push_back(make_term(k, ANY_KEY));
+        terms.push_back(make_term(ANY_KEY, ANY_KEY));
+        rule_value_tokens(fold_ut_string(value), tokens);
+        for (auto& tok : tokens) {
+            uint32_t t = intern(tok);
+            terms.push_back(make_term(k, t));
+            terms.push_back(make_term(ANY_KEY, t));
+        }
+    }
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+    std::vector<uint64_t> old;
+    auto it = servers_.find(server_id);
+    if (it != servers_.end()) old = std::move(it->second);
+
+    std::vector<uint64_t> removed, added;
+    std::set_difference(old.begin(), old.end(), terms.begin(), terms.end(),
+                        std::back_inserter(removed));
+    std::set_difference(terms.begin(), terms.end(), old.begin(), old.end(),
+                        std::back_inserter(added));
+
+    // Link first so strings shared by removed and added terms keep a ref
+    for (uint64_t term : added) {
+        auto [pit, created] = postings_.try_emplace(term);
+        if (created) ref_term(term, +1);
+        auto& list = pit->second;
+        auto lit = std::lower_bound(list.begin(), list.end(), server_id);
+        if (lit == list.end() || *lit != server_id)
+            list.insert(lit, server_id);
+    }
+
+    for (uint64_t term : removed) {
+        auto pit = postings_.find(term);
+        if (pit == postings_.end()) continue;
+        auto& list = pit->second;
+        auto lit = std::lower_bound(list.begin(), list.end(), server_id);
+        if (lit != list.end() && *lit == server_id)
+            list.erase(lit);
+        if (list.empty()) {
+            postings_.erase(pit);
+            ref_term(term, -1);
+        }
+    }
+    if (terms.empty())
+        servers_.erase(server_id);
+    else
+        servers_[server_id] = std::move(terms);
+}
+
+void RuleIndex::remove(uint32_t server_id) {
+    update(server_id, {});
+}
+
+void RuleIndex::clear() {
+    strings_.clear();
+    interned_.clear();
+    free_ids_.clear();
+    postings_.clear();
+    servers_.clear();
+}
+
+std::vector<uint32_t> RuleIndex::find(const std::string& key, const std::string& token) const {
+    auto* list = postings(key, token);
+    return list ? *list : std::vector<uint32_t>{};
+}
+
+std::vector<uint32_t> RuleIndex::find_all(
+    const std::vector<std::pair<std::string, std::string>>& terms) const
+{
+    std::vector<const std::vector<uint32_t>*> lists;
+    for (auto& [key, token] : terms) {
+        auto* list = postings(key, token);
+        if (!list) return {};
+        lists.push_back(list);
+    }
+    if (lists.empty()) return {};
+    std::sort(lists.begin(), lists.end(),
+        [](auto* a, auto* b) { return a->size() < b->size(); });
+
+    std::vector<uint32_t> result = *lists[0];
+    std::vector<uint32_t> tmp;
+    for (size_t i = 1; i < lists.size() && !result.empty(); ++i) {
+        tmp.clear();
+        std::set_intersection(result.begin(), result.end(),
+                              lists[i]->begin(), lists[i]->end(), std::back_inserter(tmp));
+        result.swap(tmp);
+    }
+    return result;
+}
+
+bool RuleIndex::contains(uint32_t server_id, const std::string& key, const std::string& token) const {
+    auto* list = postings(key, token);
+    return list && std::binary_search(list->begin(), list->end(), server_id);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "query.h"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Cross-server player search. Player names are color-stripped and lowercased,
+// split into byte trigrams, and each trigram maps to the sorted list of server
+// ids whose roster contains it. A substring query intersects the posting lists
+// of its trigrams and only verifies the few surviving candidates.
+//
+// Updated incrementally: replacing a server's roster only touches the posting
+// lists of trigrams that appeared or disappeared.
+class PlayerIndex {
+public:
+    struct Hit {
+        uint32_t server_id;
+        std::string name; // original name, color codes intact
+    };
+
+    void update(uint32_t server_id, const std::vector<PlayerInfo>& players);
+    void remove(uint32_t server_id);
+    void clear();
+
+    // Case-insensitive substring search across all indexed rosters. With
+    // `accept`, servers it rejects are skipped and don't count toward `limit`.
+    std::vector<Hit> find(const std::string& query, size_t limit = 100,
+                          const std::function<bool(uint32_t)>& accept = {}) const;
+
+    size_t server_count() const { return servers_.size(); }
+
+    // Bumped on every change, so callers can keep search results until then.
+    uint64_t generation() const { return generation_; }
+
+private:
+    struct Roster {
+        std::vector<std::string> names;   // as received
+        std::vector<std::string> folded;  // color-stripped, lowercase
+        std::vector<uint32_t> grams;      // sorted, unique
+    };
+
+    std::unordered_map<uint32_t, Roster> servers_;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings_; // trigram -> sorted server ids
+    uint64_t generation_ = 0;
+
+    void unlink(uint32_t server_id, const std::vector<uint32_t>& grams);
+    void link(uint32_t server_id, const std::vector<uint32_t>& grams);
+};
+
+// Split a folded rule value into its match tokens: the whole value plus each
+// alphanumeric word, e.g. "xgame.mutinstagib, utcomp" yields the full string,
+// "xgame", "mutinstagib" and "utcomp".
+void rule_value_tokens(const std::string& folded_value, std::vector<std::string>& out);
+
+// Inverted index over server rules (ServerInfo::variables). Keys and value
+// tokens are folded and interned; each (key, token) term maps to the sorted
+// list of server ids that have it. Every token is also indexed under the
+// wildcard key "*", so "any server running UTComp" is a single lookup and
+// "UTComp with TimeLimit=20" is a sorted-list intersection. Interned strings
+// are refcounted by the terms that use them, so values that disappear from
+// every server are released.
+class RuleIndex {
+public:
+    void update(uint32_t server_id, const std::multimap<std::string, std::string>& variables);
+    void remove(uint32_t server_id);
+    void clear();
+
+    // Sorted server ids whose rule `key` ("*" = any key) has a value or value
+    // word equal to `token`, case-insensitively. Empty token = key present.
+    std::vector<uint32_t> find(const std::string& key, const std::string& token) const;
+
+    // Intersection of several (key, token) terms.
+    std::vector<uint32_t> find_all(
+        const std::vector<std::pair<std::string, std::string>>& terms) const;
+
+    bool contains(uint32_t server_id, const std::string& key, const std::string& token) const;
+
+    size_t server_count() const { return servers_.size(); }
+
+private:
+    static constexpr uint32_t ANY_KEY = 0;
+
+    struct Interned {
+        std::string text;
+        uint32_t refs = 0; // posting lists whose term uses this id
+    };
+
+    std::unordered_map<std::string, uint32_t> strings_; // folded key/token -> interned id
+    std::vector<Interned> interned_;                    // by id (0 unused)
+    std::vector<uint32_t> free_ids_;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> postings_; // (key, token) -> sorted server ids
+    std::unordered_map<uint32_t, std::vector<uint64_t>> servers_;  // server id -> sorted terms
+
+    uint32_t intern(const std::string& s);
+    void ref_term(uint64_t term, int delta);
+    bool lookup_term(const std::string& key, const std::string& token, uint64_t& term) const;
+    const std::vector<uint32_t>* postings(const std::string& key, const std::string& token) const;
+};
@@ -0,0 +1,172 @@
+#include "jsonwriter.h"
+#include "strutil.h"
+
+#include <charconv>
+#include <cmath>
+
+static constexpr size_t FLUSH_THRESHOLD = 64 * 1024;
+
+JsonWriter::JsonWriter(FILE* out, int indent) : out_(out), indent_(indent) {
+    buf_.reserve(FLUSH_THRESHOLD + 4096);
+}
+
+JsonWriter::JsonWriter(std::string& out, int indent) : str_(&out), indent_(indent) {
+    buf_.reserve(FLUSH_THRESHOLD + 4096);
+}
+
+JsonWriter::~JsonWriter() {
+    flush();
+}
+
+void JsonWriter::flush() {
+    if (buf_.empty()) return;
+    if (str_)
+        str_->append(buf_);
+    else
+        std::fwrite(buf_.data(), 1, buf_.size(), out_);
+    written_ += buf_.size();
+    buf_.clear();
+}
+
+void JsonWriter::reserve_flush() {
+    if (buf_.size() >= FLUSH_THRESHOLD) flush();
+}
+
+void JsonWriter::newline_indent() {
+    if (indent_ < 0) return;
+    buf_.push_back('\n');
+    buf_.append(stack_.size() * static_cast<size_t>(indent_), ' ');
+}
+
+// Comma and indentation before an array element or object key.
+void JsonWriter::before_value() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (stack_.empty()) return;
+    Level& top = stack_.back();
+    if (!top.empty) buf_.push_back(',');
+    top.empty = false;
+    newline_indent();
+}
+
+void JsonWriter::open(char c, bool array) {
+    before_value();
+    buf_.push_back(c);
+    stack_.push_back({array});
+}
+
+void JsonWriter::close(char c) {
+    bool empty = stack_.back().empty;
+    stack_.pop_back();
+    if (!empty) newline_indent();
+    buf_.push_back(c);
+    reserve_flush();
+}
+
+void JsonWriter::begin_object() { open('{', false); }
+void JsonWriter::end_object() { close('}'); }
+void JsonWriter::begin_array() { open('[', true); }
+void JsonWriter::end_array() { close(']'); }
+
+JsonWriter& JsonWriter::key(std::string_view k) {
+    before_value();
+    string(k, false);
+    buf_.push_back(':');
+    if (indent_ >= 0) buf_.push_back(' ');
+    after_key_ = true;
+    return *this;
+}
+
+void JsonWriter::value(std::string_view s) {
+    before_value();
+    string(s, false);
+    reserve_flush();
+}
+
+void JsonWriter::ut_string(std::string_view s) {
+    before_value();
+    string(s, true);
+    reserve_flush();
+}
+
+void JsonWriter::value(int64_t v) {
+    before_value();
+    char tmp[24];
+    auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    buf_.append(tmp, res.ptr);
+}
+
+void JsonWriter::value(double v) {
+    before_value();
+    if (!std::isfinite(v)) {
+        buf_.append("null");
+        return;
+    }
+    char tmp[32];
+    auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    buf_.append(tmp, res.ptr);
+}
+
+void JsonWriter::value(bool v) {
+    before_value();
+    buf_.append(v ? "true" : "false");
+}
+
+void JsonWriter::null() {
+    before_value();
+    buf_.append("null");
+}
+
+void JsonWriter::newline() {
+    buf_.push_back('\n');
+    reserve_flush();
+}
+
+void JsonWriter::string(std::string_view s, bool strip_colors) {
+    static const char hex[] = "0123456789abcdef";
+    buf_.push_back('"');
+    size_t run = 0; // start of the pending run of bytes that need no escaping
+    for (size_t i = 0; i < s.size();) {
+        auto c = static_cast<unsigned char>(s[i]);
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            ++i;
+            continue;
+        }
+        buf_.append(s.data() + run, i - run);
+
+        if (strip_colors && c == 0x1B && i + 3 < s.size()) {
+            i += 4; // ESC + R + G + B
+        } else if (c >= 0x80) {
+            size_t len = utf8_sequence(s, i);
+            if (len) {
+                buf_.append(s.data() + i, len);
+                i += len;
+            } else {
+                // Latin-1 byte -> two-byte UTF-8
+                buf_.push_back(static_cast<char>(0xC0 | (c >> 6)));
+                buf_.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+                ++i;
+            }
+        } else {
+            switch (c) {
+                case '"':  buf_.append("\\\""); break;
+                case '\\': buf_.append("\\\\"); break;
+                case '\b': buf_.append("\\b"); break;
+                case '\f': buf_.append("\\f"); break;
+                case '\n': buf_.append("\\n"); break;
+                case '\r': buf_.append("\\r"); break;
+                case '\t': buf_.append("\\t"); break;
+                default: {
+                    char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+                    buf_.append(esc, sizeof(esc));
+                }
+            }
+            ++i;
+        }
+        run = i;
+    }
+    buf_.append(s.data() + run, s.size() - run);
+    buf_.push_back('"');
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Streaming JSON writer. Values are escaped straight into a buffer that is
+// written to `out` whenever it fills, so output of any size is produced in
+// constant memory without building a DOM first.
+//
+// indent < 0 writes compact JSON (one line, as used for NDJSON); otherwise
+// nested values are indented by `indent` spaces like json::dump(indent).
+// Strings that aren't valid UTF-8 (UT2004 sends Latin-1) are transcoded from
+// Latin-1 byte by byte so the output is always valid JSON.
+class JsonWriter {
+public:
+    explicit JsonWriter(FILE* out, int indent = -1);
+    // Append to a string instead (e.g. a socket response body).
+    explicit JsonWriter(std::string& out, int indent = -1);
+    ~JsonWriter();
+
+    JsonWriter(const JsonWriter&) = delete;
+    JsonWriter& operator=(const JsonWriter&) = delete;
+
+    void begin_object();
+    void end_object();
+    void begin_array();
+    void end_array();
+
+    // Object member name; the next call writes its value.
+    JsonWriter& key(std::string_view k);
+
+    void value(std::string_view s);
+    void value(const char* s) { value(std::string_view(s)); }
+    void value(const std::string& s) { value(std::string_view(s)); }
+    void value(int64_t v);
+    void value(int v) { value(static_cast<int64_t>(v)); }
+    void value(unsigned v) { value(static_cast<int64_t>(v)); }
+    void value(double v);
+    void value(bool v);
+    void null();
+
+    // String with UT2004 color codes (ESC R G B) removed.
+    void ut_string(std::string_view s);
+
+    // Raw newline between top-level values (NDJSON record separator).
+    void newline();
+
+    void flush();
+
+    size_t bytes_written() const { return written_ + buf_.size(); }
+
+private:
+    struct Level {
+        bool array;
+        bool empty = true;
+    };
+
+    FILE* out_ = nullptr;
+    std::string* str_ = nullptr;
+    int indent_;
+    std::string buf_;
+    std::vector<Level> stack_;
+    bool after_key_ = false;
+    size_t written_ = 0;
+
+    void before_value();
+    void open(char c, bool array);
+    void close(char c);
+    void newline_indent();
+    void string(std::string_view s, bool strip_colors);
+    void reserve_flush();
+};
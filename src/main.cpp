@@ -1,5 +1,7 @@
 #include "app.h"
+#include "cli.h"
 #include "icon_data.h"
+#include "paths.h"
 #include "query.h"
 #include "utcolor.h"
 
@@ -10,74 +12,31 @@
 #include <imgui_impl_sdl3.h>
 #include <imgui_impl_sdlrenderer3.h>
 
-#include <nlohmann/json.hpp>
-
 #include <algorithm>
+#include <cfloat>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <deque>
 #include <string>
+#include <unordered_set>
 
 #ifndef _WIN32
 #include <sys/stat.h>
 #include <unistd.h>
 #endif
 
-using json = nlohmann::json;
-
-#ifndef _WIN32
-// Return ~/.utquery/, creating the directory if it doesn't exist.
-static std::string get_config_dir() {
-    const char* home = getenv("HOME");
-    if (!home) home = ".";
-    std::string dir = std::string(home) + "/.utquery";
-    mkdir(dir.c_str(), 0755);
-    return dir + "/";
-}
-
-// Search for cdkey file in multiple locations, return the first found.
-static std::string find_cdkey_path() {
-    const char* home = getenv("HOME");
-    if (home) {
-        std::string paths[] = {
-            std::string(home) + "/.ut2004/cdkey",
-            std::string(home) + "/.utquery/cdkey",
-        };
-        for (auto& p : paths) {
-            if (access(p.c_str(), R_OK) == 0)
-                return p;
-        }
-    }
-    // Fall back to current directory
-    return "cdkey";
-}
-#endif
-
-static std::string get_config_path() {
-#ifdef _WIN32
-    return "servers.json";
-#else
-    return get_config_dir() + "servers.json";
-#endif
-}
-
-static std::string get_cdkey_path() {
-#ifdef _WIN32
-    return "cdkey";
-#else
-    return find_cdkey_path();
-#endif
-}
-
 // Render the server table + detail panel for a given server list.
 // table_id must be unique per tab. Returns remove_idx or -1.
 static void draw_server_list(
     std::vector<ServerEntry>& servers, int& selected,
     const char* table_id, const char* child_id, const char* detail_id,
-    const char* splitter_id, ImGuiIO& io,
+    const char* splitter_id, ImGuiIO& io, const HistoryStore& history,
     float& detail_height, bool show_remove,
     bool& auto_refresh, float& refresh_interval,
+    int& force_probe_idx, std::vector<int>& visible_rows, int& hovered_row,
     int* add_favorite_idx = nullptr)
 {
     float splitter_thickness = 6.0f;
@@ -163,102 +122,132 @@ static void draw_server_list(
                 }
             }
 
-            int remove_idx = -1;
-            for (int i = 0; i < static_cast<int>(servers.size()); ++i) {
-                auto& se = servers[i];
-                ImGui::TableNextRow();
-                ImGui::PushID(i);
+            // Only the rows in view are drawn; they are also what the query
+            // scheduler runs first
+            std::vector<int> rows;
+            rows.reserve(servers.size());
+            for (int i = 0; i < static_cast<int>(servers.size()); ++i)
+                if (!servers[i].filtered) rows.push_back(i);
+            visible_rows.clear();
+            hovered_row = -1;
 
-                if (show_remove) {
-                    ImGui::TableSetColumnIndex(0);
-                    if (ImGui::SmallButton("X")) {
-                        remove_idx = i;
-                    }
-                    ImGui::SameLine();
-                    if (ImGui::SmallButton("R")) {
-                        // Caller handles refresh
+            int remove_idx = -1;
+            ImGuiListClipper clipper;
+            clipper.Begin(static_cast<int>(rows.size()));
+            while (clipper.Step()) {
+                for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r) {
+                    int i = rows[r];
+                    auto& se = servers[i];
+                    visible_rows.push_back(i);
+                    ImGui::TableNextRow();
+                    ImGui::PushID(i);
+
+                    if (show_remove) {
+                        ImGui::TableSetColumnIndex(0);
+                        if (ImGui::SmallButton("X")) {
+                            remove_idx = i;
+                        }
+                        ImGui::SameLine();
+                        if (ImGui::SmallButton("R")) {
+                            // Caller handles refresh
+                        }
                     }
-                }
 
-                // Order column (favorites only)
-                if (show_remove) {
-                    ImGui::TableSetColumnIndex(1);
-                    ImGui::Text("%d", se.order);
-                }
+                    // Order column (favorites only)
+                    if (show_remove) {
+                        ImGui::TableSetColumnIndex(1);
+                        ImGui::Text("%d", se.order);
+                    }
 
-                // Name column — clickable to select
-                int name_col = show_remove ? 2 : 0;
-                ImGui::TableSetColumnIndex(name_col);
-                bool is_selected = (selected == i);
-                std::string raw_label = se.info.name.empty()
-                    ? (se.info.address + ":" + std::to_string(se.info.port))
-                    : se.info.name;
-                ImVec2 text_pos = ImGui::GetCursorScreenPos();
-                if (ImGui::Selectable(("##srv" + std::to_string(i)).c_str(), is_selected,
-                                      ImGuiSelectableFlags_SpanAllColumns)) {
-                    selected = is_selected ? -1 : i;
-                }
-                if (show_remove && ImGui::BeginDragDropSource(ImGuiDragDropFlags_None)) {
-                    ImGui::SetDragDropPayload("FAV_REORDER", &i, sizeof(int));
-                    std::string drag_label = se.info.name.empty()
+                    // Name column — clickable to select
+                    int name_col = show_remove ? 2 : 0;
+                    ImGui::TableSetColumnIndex(name_col);
+                    bool is_selected = (selected == i);
+                    std::string raw_label = se.info.name.empty()
                         ? (se.info.address + ":" + std::to_string(se.info.port))
-                        : strip_ut_colors(se.info.name);
-                    ImGui::Text("Move: %s", drag_label.c_str());
-                    ImGui::EndDragDropSource();
-                }
-                if (show_remove && ImGui::BeginDragDropTarget()) {
-                    if (const ImGuiPayload* payload = ImGui::AcceptDragDropPayload("FAV_REORDER")) {
-                        int src = *static_cast<const int*>(payload->Data);
-                        int dst = i;
-                        if (src != dst) {
-                            ServerEntry tmp = std::move(servers[src]);
-                            servers.erase(servers.begin() + src);
-                            servers.insert(servers.begin() + dst, std::move(tmp));
-                            if (selected == src)
-                                selected = dst;
-                            else if (src < dst && selected > src && selected <= dst)
-                                --selected;
-                            else if (src > dst && selected >= dst && selected < src)
-                                ++selected;
-                            // Only reassign order values when sorted by Order column
-                            if (active_sort_col == -1) {
-                                for (int k = 0; k < static_cast<int>(servers.size()); ++k)
-                                    servers[k].order = k + 1;
+                        : se.info.name;
+                    ImVec2 text_pos = ImGui::GetCursorScreenPos();
+                    if (ImGui::Selectable(("##srv" + std::to_string(i)).c_str(), is_selected,
+                                          ImGuiSelectableFlags_SpanAllColumns)) {
+                        selected = is_selected ? -1 : i;
+                    }
+                    if (ImGui::IsItemHovered())
+                        hovered_row = i;
+                    if (show_remove && ImGui::BeginDragDropSource(ImGuiDragDropFlags_None)) {
+                        ImGui::SetDragDropPayload("FAV_REORDER", &i, sizeof(int));
+                        std::string drag_label = se.info.name.empty()
+                            ? (se.info.address + ":" + std::to_string(se.info.port))
+                            : strip_ut_colors(se.info.name);
+                        ImGui::Text("Move: %s", drag_label.c_str());
+                        ImGui::EndDragDropSource();
+                    }
+                    if (show_remove && ImGui::BeginDragDropTarget()) {
+                        if (const ImGuiPayload* payload = ImGui::AcceptDragDropPayload("FAV_REORDER")) {
+                            int src = *static_cast<const int*>(payload->Data);
+                            int dst = i;
+                            if (src != dst) {
+                                ServerEntry tmp = std::move(servers[src]);
+                                servers.erase(servers.begin() + src);
+                                servers.insert(servers.begin() + dst, std::move(tmp));
+                                if (selected == src)
+                                    selected = dst;
+                                else if (src < dst && selected > src && selected <= dst)
+                                    --selected;
+                                else if (src > dst && selected >= dst && selected < src)
+                                    ++selected;
+                                // Only reassign order values when sorted by Order column
+                                if (active_sort_col == -1) {
+                                    for (int k = 0; k < static_cast<int>(servers.size()); ++k)
+                                        servers[k].order = k + 1;
+                                }
                             }
                         }
+                        ImGui::EndDragDropTarget();
                     }
-                    ImGui::EndDragDropTarget();
-                }
-                if (add_favorite_idx && ImGui::BeginPopupContextItem()) {
-                    if (ImGui::MenuItem("Add to Favorites")) {
-                        *add_favorite_idx = i;
+                    if (ImGui::BeginPopupContextItem()) {
+                        if (add_favorite_idx && ImGui::MenuItem("Add to Favorites")) {
+                            *add_favorite_idx = i;
+                        }
+                        if (ImGui::MenuItem("Force Probe")) {
+                            force_probe_idx = i;
+                        }
+                        if (ImGui::BeginMenu("Protocol")) {
+                            for (auto p : {QueryProtocol::Native, QueryProtocol::GameSpy, QueryProtocol::Auto}) {
+                                if (ImGui::MenuItem(query_protocol_name(p), nullptr, se.protocol == p))
+                                    se.protocol = p;
+                            }
+                            ImGui::EndMenu();
+                        }
+                        ImGui::EndPopup();
                     }
-                    ImGui::EndPopup();
-                }
-                TextUTOverlay(ImGui::GetWindowDrawList(), text_pos, raw_label);
+                    TextUTOverlay(ImGui::GetWindowDrawList(), text_pos, raw_label);
 
-                ImGui::TableSetColumnIndex(name_col + 1);
-                TextUT(se.info.map_name);
+                    ImGui::TableSetColumnIndex(name_col + 1);
+                    TextUT(se.info.map_name);
 
-                ImGui::TableSetColumnIndex(name_col + 2);
-                TextUT(se.info.gametype);
+                    ImGui::TableSetColumnIndex(name_col + 2);
+                    TextUT(se.info.gametype);
 
-                ImGui::TableSetColumnIndex(name_col + 3);
-                ImGui::Text("%d", se.info.num_players);
+                    ImGui::TableSetColumnIndex(name_col + 3);
+                    ImGui::Text("%d", se.info.num_players);
 
-                ImGui::TableSetColumnIndex(name_col + 4);
-                ImGui::Text("%d", se.info.max_players);
+                    ImGui::TableSetColumnIndex(name_col + 4);
+                    ImGui::Text("%d", se.info.max_players);
 
-                ImGui::TableSetColumnIndex(name_col + 5);
-                if (se.info.online)
-                    ImGui::Text("%d", se.info.ping);
-                else
-                    ImGui::TextUnformatted("-");
+                    ImGui::TableSetColumnIndex(name_col + 5);
+                    if (se.info.online) {
+                        ImGui::Text("%d", se.info.ping);
+                        if (se.info.ping_samples > 1 && ImGui::IsItemHovered())
+                            ImGui::SetTooltip("Median %d ms, min %d ms, jitter %d ms",
+                                              se.info.ping, se.info.ping_min, se.info.ping_jitter);
+                    } else
+                        ImGui::TextUnformatted("-");
 
-                ImGui::TableSetColumnIndex(name_col + 6);
-                ImGui::TextUnformatted(se.info.status.c_str());
+                    ImGui::TableSetColumnIndex(name_col + 6);
+                    ImGui::TextUnformatted(se.info.status.c_str());
 
-                ImGui::PopID();
+                    ImGui::PopID();
+                }
             }
             ImGui::EndTable();
 
@@ -283,7 +272,11 @@ static void draw_server_list(
         auto& se = servers[selected];
 
         if (ImGui::BeginChild(detail_id, ImVec2(0, 0))) {
-            ImGui::Text("Server: %s:%d", se.info.address.c_str(), se.info.port);
+            if (!se.info.ip.empty() && se.info.ip != se.info.address)
+                ImGui::Text("Server: %s:%d (%s)", se.info.address.c_str(), se.info.port,
+                            se.info.ip.c_str());
+            else
+                ImGui::Text("Server: %s:%d", se.info.address.c_str(), se.info.port);
             ImGui::SameLine(0, 20);
             {
                 std::string map_plain = strip_ut_colors(se.info.map_name);
@@ -302,6 +295,30 @@ static void draw_server_list(
             ImGui::SliderFloat("##RefreshInterval", &refresh_interval, 10.0f, 60.0f, "%.0f s");
             if (!auto_refresh) ImGui::EndDisabled();
 
+            if (history.is_open() && ImGui::CollapsingHeader("History (24 h)")) {
+                auto now = std::chrono::system_clock::now().time_since_epoch();
+                int64_t to = std::chrono::duration_cast<std::chrono::seconds>(now).count() + 1;
+                std::vector<float> players, ping;
+                int max_players = 0;
+                history.scan(QueryCache::key(se.info.address, se.info.port), to - 24 * 3600, to,
+                    [&](const HistorySample& s) {
+                        players.push_back(static_cast<float>(s.players));
+                        ping.push_back(s.online ? static_cast<float>(s.ping) : 0.0f);
+                        max_players = std::max(max_players, s.max_players);
+                    });
+                if (players.empty()) {
+                    ImGui::TextDisabled("No samples yet");
+                } else {
+                    float width = ImGui::GetContentRegionAvail().x * 0.5f - 4.0f;
+                    ImGui::PlotLines("##HistPlayers", players.data(), static_cast<int>(players.size()),
+                                     0, "Players", 0.0f, static_cast<float>(std::max(max_players, 1)),
+                                     ImVec2(width, 60));
+                    ImGui::SameLine();
+                    ImGui::PlotLines("##HistPing", ping.data(), static_cast<int>(ping.size()),
+                                     0, "Ping", 0.0f, FLT_MAX, ImVec2(width, 60));
+                }
+            }
+
             // Two columns: players on left, variables on right
             if (ImGui::BeginTable("DetailColumns", 2, ImGuiTableFlags_Resizable)) {
                 ImGui::TableNextRow();
@@ -410,167 +427,236 @@ static void draw_server_list(
     }
 }
 
-#ifdef _WIN32
-#include <windows.h>
-static void hide_console() {
-    HWND hw = GetConsoleWindow();
-    if (hw) ShowWindow(hw, SW_HIDE);
+// Adaptive auto-refresh limits, shared by both tabs: fastest interval (for
+// busy servers) and packet budget. Idle servers stretch toward max_interval.
+static void draw_refresh_policy(const char* id, RefreshPolicy& policy)
+{
+    ImGui::PushID(id);
+    ImGui::SetNextItemWidth(120);
+    ImGui::SliderFloat("##MinInterval", &policy.min_interval, 5.0f, 120.0f, "every %.0f s+");
+    if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("Busy servers refresh this often; idle ones up to every %.0f s",
+                          policy.max_interval);
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(120);
+    ImGui::SliderFloat("##Budget", &policy.budget, 5.0f, 200.0f, "%.0f pkt/s");
+    if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("Query packets per second for all auto-refreshed servers");
+    ImGui::PopID();
 }
-#endif
 
-static void print_help(const char* prog) {
-    std::fprintf(stderr,
-        "Usage: %s [OPTIONS]\n"
-        "\n"
-        "Options:\n"
-        "  --help                Show this help message and exit\n"
-        "  --query <servers>     Query servers and output JSON to stdout\n"
-        "                        <servers> is a comma-separated list of host:port\n"
-        "                        If port is omitted, 7777 is assumed\n"
-        "  --file <path>         Write JSON output to a file instead of stdout\n"
-        "                        (used with --query)\n"
-        "\n"
-        "Examples:\n"
-        "  %s --query 192.168.1.1:7777,10.0.0.1,example.com:7778\n"
-        "  %s --query myserver.com\n"
-        "  %s --query myserver.com --file results.json\n"
-        "\n"
-        "If no options are given, the GUI server browser is launched.\n",
-        prog, prog, prog, prog);
+// Filter expression input shared by both tabs. Recompiles on every edit so the
+// list narrows while typing; a syntax error keeps the previous filter active.
+static void draw_filter_bar(const char* id, char* buf, size_t buf_size,
+                            ServerFilter& filter, const std::vector<ServerEntry>& servers)
+{
+    ImGui::SetNextItemWidth(450);
+    if (ImGui::InputTextWithHint(id, "Filter: players>=4 && !full && map~CTF && ping<80",
+                                 buf, buf_size)) {
+        filter.compile(buf);
+    }
+    ImGui::SameLine();
+    if (!filter.error().empty()) {
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", filter.error().c_str());
+    } else if (!filter.empty()) {
+        int shown = 0;
+        for (auto& se : servers)
+            if (!se.filtered) ++shown;
+        ImGui::Text("%d of %d servers", shown, static_cast<int>(servers.size()));
+    }
 }
 
-static std::string strip_colors(const std::string& s) {
-    std::string result;
-    result.reserve(s.size());
-    for (size_t i = 0; i < s.size(); ++i) {
-        if (static_cast<unsigned char>(s[i]) == 0x1B && i + 3 < s.size()) {
-            i += 3;
-        } else {
-            result.push_back(s[i]);
-        }
+// "Find player" box state for one tab. The search is only re-run when the
+// text or the player index changes; hits keep server ids, not rows, so they
+// survive sorting.
+struct PlayerSearch {
+    char buf[64] = "";
+    std::string query;
+    uint64_t index_gen = ~0ull;
+    std::vector<PlayerIndex::Hit> hits;
+};
+
+// "Find player" box: looks the name up in the player index and lists the hits
+// that belong to this tab. Clicking a hit selects its server.
+static void draw_player_search(const char* id, PlayerSearch& search, const App& app,
+                               const std::vector<ServerEntry>& servers, int& selected)
+{
+    ImGui::SetNextItemWidth(200);
+    ImGui::InputTextWithHint(id, "Find player", search.buf, sizeof(search.buf));
+    if (search.buf[0] == '\0') {
+        search.query.clear();
+        search.hits.clear();
+        return;
     }
-    return result;
-}
 
-static int run_query(const char* server_list, const char* output_file) {
-    query_init();
+    if (search.query != search.buf || search.index_gen != app.player_index.generation()) {
+        search.query = search.buf;
+        search.index_gen = app.player_index.generation();
+        std::unordered_set<uint32_t> ids;
+        ids.reserve(servers.size());
+        for (auto& se : servers) ids.insert(se.id);
+        search.hits = app.player_index.find(search.query, 9,
+            [&](uint32_t server_id) { return ids.count(server_id) != 0; });
+    }
 
-    // Parse comma-separated server list
-    std::vector<std::pair<std::string, uint16_t>> targets;
-    std::string input(server_list);
-    size_t pos = 0;
-    while (pos < input.size()) {
-        size_t comma = input.find(',', pos);
-        if (comma == std::string::npos) comma = input.size();
-        std::string token = input.substr(pos, comma - pos);
-        pos = comma + 1;
-
-        if (token.empty()) continue;
-
-        std::string host;
-        uint16_t port = 7777;
-        size_t colon = token.rfind(':');
-        if (colon != std::string::npos) {
-            host = token.substr(0, colon);
-            int p = std::atoi(token.substr(colon + 1).c_str());
-            if (p > 0 && p < 65536) port = static_cast<uint16_t>(p);
-        } else {
-            host = token;
+    int shown = 0;
+    for (auto& hit : search.hits) {
+        int row = app.row_of(servers, hit.server_id);
+        if (row < 0) continue;
+        if (shown == 0) ImGui::Indent();
+        if (++shown > 8) {
+            ImGui::TextDisabled("...");
+            break;
         }
-        if (!host.empty())
-            targets.push_back({host, port});
+        const auto& info = servers[row].info;
+        std::string label = strip_ut_colors(hit.name) + "  @  " +
+            (info.name.empty() ? info.address + ":" + std::to_string(info.port)
+                               : strip_ut_colors(info.name));
+        ImGui::PushID(shown);
+        if (ImGui::Selectable(label.c_str(), selected == row))
+            selected = row;
+        ImGui::PopID();
     }
+    if (shown == 0)
+        ImGui::TextDisabled("  no players found");
+    else
+        ImGui::Unindent();
+}
 
-    if (targets.empty()) {
-        std::fprintf(stderr, "Error: no valid servers specified\n");
-        query_cleanup();
-        return 1;
-    }
+// Roster events taken from App::roster_events so far, for the Events tab.
+// The watch box narrows the list to players/servers containing its text;
+// matching joins and free slots are counted in the tab title until viewed.
+struct EventLog {
+    std::deque<RosterEvent> events;
+    uint64_t seq = 0;
+    char watch[64] = "";
+    bool show_scores = false;
+    int unseen = 0;
+};
+
+static bool event_matches(const RosterEvent& e, const std::string& folded_watch) {
+    if (folded_watch.empty()) return true;
+    return fold_ut_string(e.player).find(folded_watch) != std::string::npos ||
+           fold_ut_string(e.server_name).find(folded_watch) != std::string::npos;
+}
 
-    // Query each server and build JSON array
-    json results = json::array();
-    for (auto& [host, port] : targets) {
-        ServerInfo info = query_server(host, port);
-        json server;
-        server["address"] = info.address;
-        server["port"] = info.port;
-        server["name"] = strip_colors(info.name);
-        server["map_name"] = strip_colors(info.map_name);
-        server["map_title"] = strip_colors(info.map_title);
-        server["gametype"] = strip_colors(info.gametype);
-        server["num_players"] = info.num_players;
-        server["max_players"] = info.max_players;
-        server["ping"] = info.ping;
-        server["online"] = info.online;
-        server["status"] = info.status;
-
-        json player_list = json::array();
-        for (auto& p : info.players) {
-            player_list.push_back({
-                {"name", strip_colors(p.name)},
-                {"score", p.score},
-                {"team", p.team}
-            });
-        }
-        server["players"] = player_list;
+static void collect_events(EventLog& log, const RosterEvents& source) {
+    auto fresh = source.since(log.seq);
+    if (fresh.empty()) return;
+    std::string watch = fold_ut_string(log.watch);
+    for (auto& e : fresh) {
+        log.seq = e.seq;
+        if (!watch.empty() && event_matches(e, watch) &&
+            (e.type == RosterEventType::Join || e.type == RosterEventType::SlotOpen))
+            ++log.unseen;
+        log.events.push_back(std::move(e));
+    }
+    if (log.events.size() <= 4096) return;
+    // Over the limit, the oldest score changes go first
+    size_t excess = log.events.size() - 4096;
+    auto drop = std::remove_if(log.events.begin(), log.events.end(), [&](const RosterEvent& e) {
+        if (excess == 0 || e.type != RosterEventType::Score) return false;
+        --excess;
+        return true;
+    });
+    log.events.erase(drop, log.events.end());
+    while (log.events.size() > 4096) log.events.pop_front();
+}
 
-        json vars = json::array();
-        for (auto& [k, v] : info.variables) {
-            vars.push_back({{"key", strip_colors(k)}, {"value", strip_colors(v)}});
-        }
-        server["variables"] = vars;
+static const char* team_name(int team) {
+    switch (team) {
+        case 0:  return "Red";
+        case 1:  return "Blue";
+        case 2:  return "Spec";
+        default: return "-";
+    }
+}
 
-        results.push_back(server);
+static void draw_events(EventLog& log) {
+    log.unseen = 0;
+    ImGui::SetNextItemWidth(200);
+    ImGui::InputTextWithHint("##EventWatch", "Watch player or server", log.watch, sizeof(log.watch));
+    ImGui::SameLine();
+    ImGui::Checkbox("Score changes", &log.show_scores);
+    ImGui::SameLine();
+    if (ImGui::Button("Clear")) log.events.clear();
+
+    std::string watch = fold_ut_string(log.watch);
+    std::vector<const RosterEvent*> rows;
+    for (auto it = log.events.rbegin(); it != log.events.rend(); ++it) {
+        if (it->type == RosterEventType::Score && !log.show_scores) continue;
+        if (event_matches(*it, watch)) rows.push_back(&*it);
     }
 
-    std::string json_str = results.dump(2) + "\n";
+    if (!ImGui::BeginTable("EventList", 5,
+            ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY |
+            ImGuiTableFlags_Resizable))
+        return;
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Time", ImGuiTableColumnFlags_WidthFixed, 70.0f);
+    ImGui::TableSetupColumn("Event", ImGuiTableColumnFlags_WidthFixed, 120.0f);
+    ImGui::TableSetupColumn("Player", ImGuiTableColumnFlags_WidthStretch);
+    ImGui::TableSetupColumn("Server", ImGuiTableColumnFlags_WidthStretch);
+    ImGui::TableSetupColumn("Players", ImGuiTableColumnFlags_WidthFixed, 60.0f);
+    ImGui::TableHeadersRow();
+
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(rows.size()));
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+            const RosterEvent& e = *rows[i];
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            char when[16] = "";
+            std::time_t t = static_cast<std::time_t>(e.time);
+            if (std::tm* tm = std::localtime(&t))
+                std::strftime(when, sizeof(when), "%H:%M:%S", tm);
+            ImGui::TextUnformatted(when);
+
+            ImGui::TableSetColumnIndex(1);
+            switch (e.type) {
+                case RosterEventType::Join:
+                    ImGui::TextColored(ImVec4(0.4f, 1.0f, 0.4f, 1.0f), "joined");
+                    break;
+                case RosterEventType::Leave:
+                    ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.4f, 1.0f), "left");
+                    break;
+                case RosterEventType::TeamChange:
+                    ImGui::Text("%s -> %s", team_name(e.old_team), team_name(e.team));
+                    break;
+                case RosterEventType::Score:
+                    ImGui::Text("score %d -> %d", e.old_score, e.score);
+                    break;
+                case RosterEventType::SlotOpen:
+                    ImGui::TextColored(ImVec4(0.4f, 0.8f, 1.0f, 1.0f), "slot free");
+                    break;
+            }
 
-    if (output_file) {
-        FILE* fp = fopen(output_file, "w");
-        if (!fp) {
-            std::fprintf(stderr, "Error: could not open file '%s' for writing\n", output_file);
-            query_cleanup();
-            return 1;
+            ImGui::TableSetColumnIndex(2);
+            std::string player = strip_ut_colors(e.player);
+            ImGui::TextUnformatted(player.c_str());
+            ImGui::TableSetColumnIndex(3);
+            std::string server = e.server_name.empty() ? e.server : strip_ut_colors(e.server_name);
+            ImGui::TextUnformatted(server.c_str());
+            ImGui::TableSetColumnIndex(4);
+            ImGui::Text("%d/%d", e.num_players, e.max_players);
         }
-        std::fwrite(json_str.data(), 1, json_str.size(), fp);
-        fclose(fp);
-        std::fprintf(stderr, "Wrote %zu bytes to %s\n", json_str.size(), output_file);
-    } else {
-        std::fwrite(json_str.data(), 1, json_str.size(), stdout);
-        fflush(stdout);
     }
+    ImGui::EndTable();
+}
 
-    query_cleanup();
-    return 0;
+#ifdef _WIN32
+#include <windows.h>
+static void hide_console() {
+    HWND hw = GetConsoleWindow();
+    if (hw) ShowWindow(hw, SW_HIDE);
 }
+#endif
 
 int main(int argc, char** argv) {
     // Handle CLI options before GUI init
-    const char* query_arg = nullptr;
-    const char* file_arg = nullptr;
-    bool show_help = false;
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "--help" || arg == "-h") {
-            show_help = true;
-        } else if (arg == "--query" && i + 1 < argc) {
-            query_arg = argv[++i];
-        } else if (arg == "--file" && i + 1 < argc) {
-            file_arg = argv[++i];
-        }
-    }
-    if (show_help) {
-        print_help(argv[0]);
-        return 0;
-    }
-    if (query_arg) {
-        return run_query(query_arg, file_arg);
-    }
-    if (file_arg) {
-        std::fprintf(stderr, "Error: --file requires --query\n");
-        print_help(argv[0]);
-        return 1;
-    }
+    int cli_rc = run_cli(argc, argv);
+    if (cli_rc >= 0) return cli_rc;
 
     // No CLI args — launch GUI mode
 #ifdef _WIN32
@@ -653,9 +739,27 @@ int main(int argc, char** argv) {
     std::string config_path = get_config_path();
     app.load_servers(config_path);
     app.load_cdkey(get_cdkey_path());
+    std::string offline_path = get_offline_cache_path();
+    app.negative_cache.load(offline_path);
+    {
+        // A running collector may already be recording; show its history then
+        std::string err;
+        if (!app.history.open(get_history_dir(), err) &&
+            !app.history.open_readonly(get_history_dir(), err))
+            std::fprintf(stderr, "History disabled: %s\n", err.c_str());
+    }
 
     char ip_buf[64] = "";
     int port_val = 7777;
+    static char fav_filter_buf[256] = "";
+    static char inet_filter_buf[256] = "";
+    static PlayerSearch fav_player_search;
+    static PlayerSearch inet_player_search;
+    static char collector_buf[128] = "";
+    static EventLog event_log;
+    std::vector<int> fav_visible, inet_visible;
+    int fav_hovered = -1, inet_hovered = -1;
+    std::snprintf(collector_buf, sizeof(collector_buf), "%s", app.collector_address.c_str());
     bool running = true;
 
     // Internet tab state
@@ -684,8 +788,7 @@ int main(int argc, char** argv) {
     static auto last_fav_refresh = std::chrono::steady_clock::now();
     static auto last_inet_refresh = std::chrono::steady_clock::now();
     static bool fav_all_auto_refresh = false;
-    static float fav_all_refresh_interval = 30.0f;
-    static auto last_fav_all_refresh = std::chrono::steady_clock::now();
+    static bool inet_all_auto_refresh = false;
     static const char* font_size_labels[] = { "Small", "Normal", "Large", "Extra Large" };
     static const float font_size_scales[] = { 0.85f, 1.0f, 1.25f, 1.5f };
     io.FontGlobalScale = font_size_scales[app.font_size_idx];
@@ -702,6 +805,7 @@ int main(int argc, char** argv) {
         }
 
         app.poll_results();
+        collect_events(event_log, app.roster_events);
 
         // Auto-refresh timers
         auto now = std::chrono::steady_clock::now();
@@ -712,13 +816,7 @@ int main(int argc, char** argv) {
                 last_fav_refresh = now;
             }
         }
-        if (fav_all_auto_refresh && !app.servers.empty()) {
-            float elapsed = std::chrono::duration<float>(now - last_fav_all_refresh).count();
-            if (elapsed >= fav_all_refresh_interval) {
-                app.refresh_all();
-                last_fav_all_refresh = now;
-            }
-        }
+        app.auto_refresh(fav_all_auto_refresh, inet_all_auto_refresh);
         if (inet_auto_refresh && app.internet_selected >= 0) {
             float elapsed = std::chrono::duration<float>(now - last_inet_refresh).count();
             if (elapsed >= inet_refresh_interval) {
@@ -740,6 +838,13 @@ int main(int argc, char** argv) {
                      ImGuiWindowFlags_NoBringToFrontOnFocus);
 
         float combo_width = 120.0f;
+        float ttl_width = 100.0f;
+        ImGui::SameLine(ImGui::GetWindowWidth() - combo_width - ttl_width - 250.0f);
+        ImGui::Text("Cache TTL:");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(ttl_width);
+        ImGui::SliderFloat("##CacheTTL", &app.cache_ttl, 0.0f, 300.0f, "%.0f s",
+                           ImGuiSliderFlags_Logarithmic);
         ImGui::SameLine(ImGui::GetWindowWidth() - combo_width - 120.0f);
         ImGui::Text("Font Size:");
         ImGui::SameLine();
@@ -776,17 +881,27 @@ int main(int argc, char** argv) {
                 ImGui::Checkbox("Auto Refresh All", &fav_all_auto_refresh);
                 ImGui::SameLine();
                 if (!fav_all_auto_refresh) ImGui::BeginDisabled();
-                ImGui::SetNextItemWidth(150);
-                ImGui::SliderFloat("##FavAllRefresh", &fav_all_refresh_interval, 10.0f, 120.0f, "%.0f s");
+                draw_refresh_policy("##FavPolicy", app.refresh_policy);
                 if (!fav_all_auto_refresh) ImGui::EndDisabled();
 
+                draw_filter_bar("##FavFilter", fav_filter_buf, sizeof(fav_filter_buf),
+                                app.filter, app.servers);
+                ImGui::SameLine(0, 20);
+                int prev_fav_sel = app.selected;
+                int fav_probe_idx = -1;
+                draw_player_search("##FavFindPlayer", fav_player_search, app,
+                                   app.servers, app.selected);
+
                 ImGui::Separator();
 
-                int prev_fav_sel = app.selected;
                 draw_server_list(app.servers, app.selected,
                     "FavServers", "FavServerList", "FavDetails", "##favsplit",
-                    io, fav_detail_height, true,
-                    fav_auto_refresh, fav_refresh_interval);
+                    io, app.history, fav_detail_height, true,
+                    fav_auto_refresh, fav_refresh_interval, fav_probe_idx, fav_visible,
+                    fav_hovered);
+                app.set_focus(app.servers, fav_visible, app.selected, fav_hovered);
+                if (fav_probe_idx >= 0)
+                    app.refresh_one(fav_probe_idx, true);
                 if (app.selected >= 0 && app.selected != prev_fav_sel) {
                     app.refresh_one(app.selected);
                     last_fav_refresh = std::chrono::steady_clock::now();
@@ -798,6 +913,9 @@ int main(int argc, char** argv) {
             // ---- Internet Tab ----
             if (ImGui::BeginTabItem("Internet")) {
                 // Top bar: master server + gametype dropdown + query button
+                // (disabled while the list comes from a collector)
+                bool attached = app.collector_attached();
+                if (attached) ImGui::BeginDisabled();
                 ImGui::SetNextItemWidth(250);
                 if (!app.master_servers.empty()) {
                     if (app.master_selected < 0 || app.master_selected >= static_cast<int>(app.master_servers.size()))
@@ -840,18 +958,72 @@ int main(int argc, char** argv) {
                     app.refresh_internet_all();
                 }
                 ImGui::SameLine();
-                if (!app.master_status.empty()) {
+                bool sweeping = app.sweeping();
+                if (sweeping) ImGui::BeginDisabled();
+                if (ImGui::Button("Ping Sweep"))
+                    app.sweep_internet();
+                if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Info query only: ping, map and player counts of every "
+                                      "server in seconds; details load when a server is opened");
+                if (sweeping) ImGui::EndDisabled();
+                ImGui::SameLine(0, 20);
+                ImGui::Checkbox("Auto Refresh All##inet", &inet_all_auto_refresh);
+                ImGui::SameLine();
+                if (!inet_all_auto_refresh) ImGui::BeginDisabled();
+                draw_refresh_policy("##InetPolicy", app.refresh_policy);
+                if (!inet_all_auto_refresh) ImGui::EndDisabled();
+                if (attached) ImGui::EndDisabled();
+                ImGui::SameLine();
+                if (attached) {
+                    std::string status = "collector: " + app.collector_status() + ", " +
+                        std::to_string(app.internet_servers.size()) + " servers";
+                    ImGui::TextUnformatted(status.c_str());
+                } else if (!app.master_status.empty()) {
                     ImGui::TextUnformatted(app.master_status.c_str());
                 }
 
-                ImGui::Separator();
+                // Collector to attach to instead of querying directly
+                ImGui::SetNextItemWidth(250);
+                if (attached) ImGui::BeginDisabled();
+                ImGui::InputText("Collector", collector_buf, sizeof(collector_buf));
+                if (attached) ImGui::EndDisabled();
+                ImGui::SameLine();
+                if (attached) {
+                    if (ImGui::Button("Detach")) {
+                        app.detach_collector();
+                        app.save_servers(config_path);
+                    }
+                } else if (ImGui::Button("Attach") && collector_buf[0]) {
+                    app.attach_collector(collector_buf);
+                    app.save_servers(config_path);
+                }
 
+                draw_filter_bar("##InetFilter", inet_filter_buf, sizeof(inet_filter_buf),
+                                app.internet_filter, app.internet_servers);
+                ImGui::SameLine(0, 20);
                 int prev_inet_sel = app.internet_selected;
+                draw_player_search("##InetFindPlayer", inet_player_search, app,
+                                   app.internet_servers, app.internet_selected);
+                app.internet_player_search = inet_player_search.buf[0] != '\0';
+                if (size_t pending = app.internet_details_pending()) {
+                    ImGui::SameLine(0, 20);
+                    ImGui::TextDisabled("Fetching details of %zu servers, results incomplete",
+                                        pending);
+                }
+
+                ImGui::Separator();
+
                 int add_fav_idx = -1;
+                int inet_probe_idx = -1;
                 draw_server_list(app.internet_servers, app.internet_selected,
                     "InetServers", "InetServerList", "InetDetails", "##inetsplit",
-                    io, inet_detail_height, false,
-                    inet_auto_refresh, inet_refresh_interval, &add_fav_idx);
+                    io, app.history, inet_detail_height, false,
+                    inet_auto_refresh, inet_refresh_interval, inet_probe_idx, inet_visible,
+                    inet_hovered, &add_fav_idx);
+                app.set_focus(app.internet_servers, inet_visible, app.internet_selected,
+                              inet_hovered);
+                if (inet_probe_idx >= 0)
+                    app.refresh_internet_one(inet_probe_idx, true);
                 if (add_fav_idx >= 0 && add_fav_idx < static_cast<int>(app.internet_servers.size())) {
                     auto& se = app.internet_servers[add_fav_idx];
                     app.add_server(se.info.address, se.info.port);
@@ -866,6 +1038,15 @@ int main(int argc, char** argv) {
                 ImGui::EndTabItem();
             }
 
+            // ---- Events Tab ----
+            char events_label[48] = "Events###Events";
+            if (event_log.unseen > 0)
+                std::snprintf(events_label, sizeof(events_label), "Events (%d)###Events", event_log.unseen);
+            if (ImGui::BeginTabItem(events_label)) {
+                draw_events(event_log);
+                ImGui::EndTabItem();
+            }
+
             ImGui::EndTabBar();
         }
 
@@ -879,6 +1060,7 @@ int main(int argc, char** argv) {
     }
 
     app.save_servers(config_path);
+    app.negative_cache.save(offline_path);
 
     ImGui_ImplSDLRenderer3_Shutdown();
     ImGui_ImplSDL3_Shutdown();
@@ -15,9 +15,11 @@
 #endif
 
 #include <algorithm>
+#include <cctype>
 #include <chrono>
 #include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <vector>
 
 #ifdef _WIN32
@@ -585,3 +587,95 @@ MasterQueryResult query_master_server(
 }
 
 #undef FAIL
+
+// ---------------------------------------------------------------------------
+// cdkey
+// ---------------------------------------------------------------------------
+
+// Normalize a raw cdkey string: filter characters, uppercase, insert dashes.
+static std::string normalize_cdkey(const std::string& raw) {
+    std::string key;
+    for (char ch : raw) {
+        if ((ch >= '0' && ch <= '9') ||
+            (ch >= 'a' && ch <= 'z') ||
+            (ch >= 'A' && ch <= 'Z') ||
+            ch == '-')
+            key.push_back(ch);
+        else if (ch == ' ' || ch == '_')
+            key.push_back('-');
+        else
+            break; // stop at first invalid char (like UT2004 does)
+    }
+    for (auto& c : key) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    if (key.find('-') == std::string::npos && key.size() == 20) {
+        key = key.substr(0,5) + "-" + key.substr(5,5) + "-" +
+              key.substr(10,5) + "-" + key.substr(15,5);
+    }
+    if (key.size() > 23)
+        key = key.substr(0, 23);
+    return key;
+}
+
+#ifdef _WIN32
+#include <windows.h>
+static std::string read_cdkey_from_registry() {
+    // Try WOW6432Node first (32-bit app on 64-bit Windows, or explicit path)
+    const char* subkeys[] = {
+        "SOFTWARE\\WOW6432Node\\Unreal Technology\\Installed Apps\\UT2004",
+        "SOFTWARE\\Unreal Technology\\Installed Apps\\UT2004",
+    };
+    for (auto subkey : subkeys) {
+        HKEY hkey = nullptr;
+        if (RegOpenKeyExA(HKEY_LOCAL_MACHINE, subkey, 0, KEY_READ, &hkey) == ERROR_SUCCESS) {
+            char buf[256] = {};
+            DWORD size = sizeof(buf) - 1;
+            DWORD type = 0;
+            if (RegQueryValueExA(hkey, "CDKey", nullptr, &type, reinterpret_cast<BYTE*>(buf), &size) == ERROR_SUCCESS
+                && type == REG_SZ) {
+                RegCloseKey(hkey);
+                return std::string(buf);
+            }
+            RegCloseKey(hkey);
+        }
+    }
+    return {};
+}
+#endif
+
+std::string read_cdkey(const std::string& path) {
+    std::string raw;
+
+    // Try file first
+    std::ifstream f(path);
+    if (f.is_open()) {
+        std::getline(f, raw);
+        std::fprintf(stderr, "cdkey: read from file '%s'\n", path.c_str());
+    }
+
+#ifdef _WIN32
+    // Fall back to Windows registry
+    if (raw.empty()) {
+        raw = read_cdkey_from_registry();
+        if (!raw.empty())
+            std::fprintf(stderr, "cdkey: read from Windows registry\n");
+    }
+#endif
+
+    if (raw.empty()) {
+        std::fprintf(stderr, "cdkey: not found (no file '%s'%s)\n",
+                     path.c_str(),
+#ifdef _WIN32
+                     " and not in registry"
+#else
+                     ""
+#endif
+                     );
+        return {};
+    }
+
+    std::string cdkey = normalize_cdkey(raw);
+    std::fprintf(stderr, "cdkey: loaded key len=%zu fmt='%.5s-...-%.5s'\n",
+                 cdkey.size(), cdkey.c_str(),
+                 cdkey.size() >= 5 ? cdkey.c_str() + cdkey.size() - 5 : "");
+    return cdkey;
+}
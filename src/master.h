@@ -29,3 +29,8 @@ MasterQueryResult query_master_server(
     const std::string& master_host, uint16_t master_port,
     const std::string& cdkey,
     const std::string& gametype_filter = "");
+
+// Read the cdkey from `path` (first line), falling back to the Windows
+// registry, and normalize it to "XXXXX-XXXXX-XXXXX-XXXXX". Returns empty if
+// none was found. Logs where it came from to stderr.
+std::string read_cdkey(const std::string& path);
@@ -0,0 +1,266 @@
+#include "output.h"
+#include "strutil.h"
+
+#include <nlohmann/json.hpp>
+
+#include <string_view>
+
+using json = nlohmann::json;
+
+namespace {
+
+// Same interface as JsonWriter, but builds a json value for the binary
+// encoders. Only one record is held at a time.
+class JsonBuilder {
+public:
+    void begin_object() { open(json::object()); }
+    void end_object() { stack_.pop_back(); }
+    void begin_array() { open(json::array()); }
+    void end_array() { stack_.pop_back(); }
+
+    JsonBuilder& key(std::string_view k) {
+        key_.assign(k);
+        return *this;
+    }
+
+    void value(std::string_view s) { put(std::string(s)); }
+    void value(const char* s) { put(std::string(s)); }
+    void value(const std::string& s) { put(s); }
+    void value(int64_t v) { put(v); }
+    void value(int v) { put(v); }
+    void value(unsigned v) { put(v); }
+    void value(double v) { put(v); }
+    void value(bool v) { put(v); }
+    void ut_string(std::string_view s) { put(ut_to_utf8(s)); }
+
+    json& root() { return root_; }
+
+private:
+    json root_;
+    std::vector<json*> stack_;
+    std::string key_;
+
+    // Children are only added to the innermost open container, so pointers
+    // to the containers on the stack stay valid.
+    json* put(json v) {
+        if (stack_.empty()) {
+            root_ = std::move(v);
+            return &root_;
+        }
+        json& top = *stack_.back();
+        if (top.is_array()) {
+            top.push_back(std::move(v));
+            return &top.back();
+        }
+        return &(top[key_] = std::move(v));
+    }
+
+    void open(json v) { stack_.push_back(put(std::move(v))); }
+};
+
+} // namespace
+
+const char* output_format_name(OutputFormat f) {
+    switch (f) {
+        case OutputFormat::Json:    return "json";
+        case OutputFormat::Ndjson:  return "ndjson";
+        case OutputFormat::Cbor:    return "cbor";
+        case OutputFormat::Msgpack: return "msgpack";
+    }
+    return "json";
+}
+
+bool parse_output_format(const std::string& s, OutputFormat& out) {
+    for (auto f : {OutputFormat::Json, OutputFormat::Ndjson, OutputFormat::Cbor,
+                   OutputFormat::Msgpack}) {
+        if (s == output_format_name(f)) {
+            out = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+RecordWriter::RecordWriter(FILE* out, OutputFormat format, bool intern)
+    : out_(out), format_(format), intern_(intern),
+      text_(out, format == OutputFormat::Json ? 2 : -1) {}
+
+RecordWriter::RecordWriter(std::string& out, OutputFormat format, bool intern)
+    : str_(&out), format_(format), intern_(intern),
+      text_(out, format == OutputFormat::Json ? 2 : -1) {}
+
+void RecordWriter::begin() {
+    if (format_ == OutputFormat::Json) text_.begin_array();
+}
+
+void RecordWriter::end() {
+    if (format_ == OutputFormat::Json) {
+        text_.end_array();
+        text_.newline();
+    }
+    flush();
+}
+
+void RecordWriter::flush() {
+    text_.flush();
+    if (out_) std::fflush(out_);
+}
+
+size_t RecordWriter::bytes_written() const {
+    return binary() ? bin_written_ : text_.bytes_written();
+}
+
+// Write one top-level record in the stream's format.
+template <typename F>
+void RecordWriter::record(F&& fill) {
+    switch (format_) {
+        case OutputFormat::Json:
+            fill(text_);
+            break;
+        case OutputFormat::Ndjson:
+            fill(text_);
+            text_.newline();
+            break;
+        case OutputFormat::Cbor:
+        case OutputFormat::Msgpack: {
+            JsonBuilder b;
+            fill(b);
+            bin_.clear();
+            if (format_ == OutputFormat::Cbor)
+                json::to_cbor(b.root(), bin_);
+            else
+                json::to_msgpack(b.root(), bin_);
+            if (str_)
+                str_->append(bin_.begin(), bin_.end());
+            else
+                std::fwrite(bin_.data(), 1, bin_.size(), out_);
+            bin_written_ += bin_.size();
+            break;
+        }
+    }
+}
+
+void RecordWriter::define(const std::string& s) {
+    auto [it, inserted] = dict_.try_emplace(s, static_cast<int64_t>(dict_.size()));
+    if (!inserted) return;
+    int64_t id = it->second;
+    record([&](auto& w) {
+        w.begin_object();
+        w.key("$def").value(id);
+        w.key("value").value(s);
+        w.end_object();
+    });
+}
+
+void RecordWriter::define_strings(const ServerInfo& info) {
+    define(ut_to_utf8(info.map_name));
+    define(ut_to_utf8(info.gametype));
+    for (auto& [k, v] : info.variables)
+        define(ut_to_utf8(k));
+}
+
+template <typename W>
+void RecordWriter::emit(W& w, const ServerInfo& info) const {
+    // Interned fields are written as their dictionary id
+    auto text = [&](const char* key, const std::string& s) {
+        if (intern_)
+            w.key(key).value(dict_.at(ut_to_utf8(s)));
+        else
+            w.key(key).ut_string(s);
+    };
+
+    w.begin_object();
+    w.key("address").value(info.address);
+    if (!info.ip.empty() && info.ip != info.address)
+        w.key("ip").value(info.ip);
+    w.key("port").value(info.port);
+    w.key("name").ut_string(info.name);
+    text("map_name", info.map_name);
+    w.key("map_title").ut_string(info.map_title);
+    text("gametype", info.gametype);
+    w.key("num_players").value(info.num_players);
+    w.key("max_players").value(info.max_players);
+    w.key("ping").value(info.ping);
+    w.key("ping_min").value(info.ping_min);
+    w.key("ping_jitter").value(info.ping_jitter);
+    w.key("flags").value(info.flags);
+    if (info.query_port)
+        w.key("query_port").value(info.query_port);
+    w.key("online").value(info.online);
+    w.key("status").value(info.status);
+
+    // Sections that weren't queried (a sweep) are left out rather than
+    // written as empty
+    if (info.sections & SECTION_PLAYERS) {
+        w.key("players").begin_array();
+        for (auto& p : info.players) {
+            w.begin_object();
+            w.key("name").ut_string(p.name);
+            w.key("score").value(p.score);
+            w.key("team").value(p.team);
+            w.end_object();
+        }
+        w.end_array();
+    }
+
+    if (info.sections & SECTION_RULES) {
+        w.key("variables").begin_array();
+        for (auto& [k, v] : info.variables) {
+            w.begin_object();
+            text("key", k);
+            w.key("value").ut_string(v);
+            w.end_object();
+        }
+        w.end_array();
+    }
+    w.end_object();
+}
+
+void RecordWriter::write(const ServerInfo& info) {
+    if (intern_) define_strings(info);
+    record([&](auto& w) { emit(w, info); });
+}
+
+bool read_server(const std::vector<uint8_t>& msgpack, ServerInfo& info) {
+    json j = json::from_msgpack(msgpack, true, false);
+    if (!j.is_object() || !j.contains("address")) return false;
+
+    try {
+        info.address = j.value("address", "");
+        info.ip = j.value("ip", "");
+        info.port = j.value("port", uint16_t{0});
+        info.query_port = j.value("query_port", uint16_t{0});
+        info.name = j.value("name", "");
+        info.map_name = j.value("map_name", "");
+        info.map_title = j.value("map_title", "");
+        info.gametype = j.value("gametype", "");
+        info.num_players = j.value("num_players", 0);
+        info.max_players = j.value("max_players", 0);
+        info.ping = j.value("ping", 0);
+        info.ping_min = j.value("ping_min", 0);
+        info.ping_jitter = j.value("ping_jitter", 0);
+        info.flags = j.value("flags", 0);
+        info.online = j.value("online", false);
+        info.status = j.value("status", "");
+
+        info.sections = SECTION_INFO;
+        if (j.contains("players")) info.sections |= SECTION_PLAYERS;
+        if (j.contains("variables")) info.sections |= SECTION_RULES;
+        std::vector<PlayerInfo> players;
+        for (auto& p : j.value("players", json::array())) {
+            PlayerInfo pi;
+            pi.name = p.value("name", "");
+            pi.score = p.value("score", 0);
+            pi.team = p.value("team", -1);
+            players.push_back(std::move(pi));
+        }
+        info.players = std::move(players);
+        std::multimap<std::string, std::string> variables;
+        for (auto& v : j.value("variables", json::array()))
+            variables.emplace(v.value("key", ""), v.value("value", ""));
+        info.variables = std::move(variables);
+    } catch (const json::exception&) {
+        return false; // wrong types, e.g. an interned record
+    }
+    return !info.address.empty();
+}
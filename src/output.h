@@ -0,0 +1,69 @@
+#pragma once
+
+#include "jsonwriter.h"
+#include "query.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class OutputFormat {
+    Json,    // one array (indented)
+    Ndjson,  // one compact JSON object per line
+    Cbor,    // concatenated CBOR items (RFC 8742 sequence)
+    Msgpack, // concatenated MessagePack objects
+};
+
+const char* output_format_name(OutputFormat f);
+bool parse_output_format(const std::string& s, OutputFormat& out);
+
+// Writes query results as a stream of records in one of the formats above.
+//
+// With `intern` set, map names, game types and rule keys are replaced by
+// integer ids. The first record that uses a string is preceded by a
+// definition record {"$def": <id>, "value": "<string>"}, so a reader keeps a
+// table of ids as it goes and the stream stays self-contained.
+class RecordWriter {
+public:
+    RecordWriter(FILE* out, OutputFormat format, bool intern = false);
+    RecordWriter(std::string& out, OutputFormat format, bool intern = false);
+
+    RecordWriter(const RecordWriter&) = delete;
+    RecordWriter& operator=(const RecordWriter&) = delete;
+
+    // Json wraps the records in an array: call begin() first and end() last.
+    void begin();
+    void end();
+
+    void write(const ServerInfo& info);
+
+    // Push buffered output to the FILE* (and fflush it) or string.
+    void flush();
+
+    size_t bytes_written() const;
+    bool binary() const { return format_ == OutputFormat::Cbor || format_ == OutputFormat::Msgpack; }
+
+private:
+    FILE* out_ = nullptr;
+    std::string* str_ = nullptr;
+    OutputFormat format_;
+    bool intern_;
+    JsonWriter text_;
+    std::vector<uint8_t> bin_;
+    size_t bin_written_ = 0;
+    std::unordered_map<std::string, int64_t> dict_;
+
+    void define_strings(const ServerInfo& info);
+    void define(const std::string& s);
+
+    template <typename W>
+    void emit(W& w, const ServerInfo& info) const;
+    template <typename F>
+    void record(F&& fill);
+};
+
+// Decode one un-interned MessagePack record written by RecordWriter (as sent
+// on the collector's /stream). Returns false if it isn't a server record.
+bool read_server(const std::vector<uint8_t>& msgpack, ServerInfo& info);
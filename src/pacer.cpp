@@ -0,0 +1,84 @@
+#include "pacer.h"
+
+#include <algorithm>
+#include <thread>
+
+SendPacer& send_pacer() {
+    static SendPacer pacer;
+    return pacer;
+}
+
+void SendPacer::set_limits(const Limits& limits) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limits_ = limits;
+    rate_ = limits.packets_per_second;
+    window_sent_ = window_lost_ = 0;
+}
+
+SendPacer::Limits SendPacer::limits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return limits_;
+}
+
+double SendPacer::current_rate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rate_;
+}
+
+// Refill `b` at `rate` (bursts up to 50 ms worth, at least one full query) and
+// take `packets` tokens, going into debt if needed. Returns the seconds to
+// wait before the debt is paid off.
+double SendPacer::take(Bucket& b, double rate, int packets,
+                       std::chrono::steady_clock::time_point now) {
+    double burst = std::max(4.0, rate * 0.05);
+    if (b.last == std::chrono::steady_clock::time_point{}) {
+        b.tokens = burst;
+    } else {
+        double elapsed = std::chrono::duration<double>(now - b.last).count();
+        b.tokens = std::min(burst, b.tokens + elapsed * rate);
+    }
+    b.last = now;
+    b.tokens -= packets;
+    return b.tokens >= 0.0 ? 0.0 : -b.tokens / rate;
+}
+
+void SendPacer::acquire(uint32_t ip, int packets) {
+    double wait = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = std::chrono::steady_clock::now();
+        if (rate_ > 0.0)
+            wait = take(global_, rate_, packets, now);
+        if (limits_.per_host_per_second > 0.0)
+            wait = std::max(wait, take(hosts_[ip], limits_.per_host_per_second, packets, now));
+
+        // Forget hosts whose bucket has been full for a while
+        if (now - last_prune_ > std::chrono::seconds(10)) {
+            last_prune_ = now;
+            for (auto it = hosts_.begin(); it != hosts_.end();) {
+                if (now - it->second.last > std::chrono::seconds(10))
+                    it = hosts_.erase(it);
+                else
+                    ++it;
+            }
+        }
+    }
+    if (wait > 0.0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+}
+
+void SendPacer::report(bool answered) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!limits_.adaptive || limits_.packets_per_second <= 0.0) return;
+    ++window_sent_;
+    if (!answered) ++window_lost_;
+    if (window_sent_ < 50) return;
+
+    double max_rate = limits_.packets_per_second;
+    double min_rate = std::min(max_rate, 20.0);
+    if (window_lost_ * 20 > window_sent_)
+        rate_ = std::max(min_rate, rate_ * 0.8);
+    else if (window_lost_ == 0)
+        rate_ = std::min(max_rate, rate_ + max_rate * 0.05);
+    window_sent_ = window_lost_ = 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+// Token-bucket pacing for every UDP query packet we send.
+//
+// A global bucket caps packets per second across all queries and a bucket
+// per destination IP caps what one host sees, so a scan doesn't overflow our
+// own socket buffers or trip the query flood protection of machines running
+// many server instances. Senders that find a bucket empty take a token on
+// credit and sleep until it would have refilled, so waiting queries go out
+// in the order they asked.
+//
+// With `adaptive` set, the global rate backs off (x0.8) when follow-up
+// queries to servers that just answered go unanswered (> 5% of a window)
+// and creeps back up (+5% of the configured rate) while none are lost.
+class SendPacer {
+public:
+    struct Limits {
+        double packets_per_second = 1000.0; // all destinations, 0 = unlimited
+        double per_host_per_second = 20.0;  // per destination IP, 0 = unlimited
+        bool adaptive = true;
+    };
+
+    void set_limits(const Limits& limits);
+    Limits limits() const;
+
+    // Current global rate (below the configured one after losses).
+    double current_rate() const;
+
+    // Block until `packets` may be sent to `ip` (network byte order).
+    void acquire(uint32_t ip, int packets = 1);
+
+    // Outcome of a query sent to a server that had just answered another:
+    // a missing reply is taken as loss on our side of the path.
+    void report(bool answered);
+
+private:
+    struct Bucket {
+        double tokens = 0.0;
+        std::chrono::steady_clock::time_point last{};
+    };
+
+    mutable std::mutex mutex_;
+    Limits limits_;
+    double rate_ = 1000.0;
+    Bucket global_;
+    std::unordered_map<uint32_t, Bucket> hosts_;
+    std::chrono::steady_clock::time_point last_prune_{};
+    int window_sent_ = 0, window_lost_ = 0;
+
+    static double take(Bucket& b, double rate, int packets,
+                       std::chrono::steady_clock::time_point now);
+};
+
+SendPacer& send_pacer();
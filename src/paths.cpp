@@ -0,0 +1,68 @@
+#include "paths.h"
+
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+// Return ~/.utquery/, creating the directory if it doesn't exist.
+static std::string get_config_dir() {
+    const char* home = getenv("HOME");
+    if (!home) home = ".";
+    std::string dir = std::string(home) + "/.utquery";
+    mkdir(dir.c_str(), 0755);
+    return dir + "/";
+}
+
+// Search for cdkey file in multiple locations, return the first found.
+static std::string find_cdkey_path() {
+    const char* home = getenv("HOME");
+    if (home) {
+        std::string paths[] = {
+            std::string(home) + "/.ut2004/cdkey",
+            std::string(home) + "/.utquery/cdkey",
+        };
+        for (auto& p : paths) {
+            if (access(p.c_str(), R_OK) == 0)
+                return p;
+        }
+    }
+    // Fall back to current directory
+    return "cdkey";
+}
+#endif
+
+std::string get_config_path() {
+#ifdef _WIN32
+    return "servers.json";
+#else
+    return get_config_dir() + "servers.json";
+#endif
+}
+
+std::string get_offline_cache_path() {
+#ifdef _WIN32
+    return "offline.json";
+#else
+    return get_config_dir() + "offline.json";
+#endif
+}
+
+std::string get_history_dir() {
+#ifdef _WIN32
+    return "history";
+#else
+    return get_config_dir() + "history";
+#endif
+}
+
+std::string get_cdkey_path() {
+#ifdef _WIN32
+    return "cdkey";
+#else
+    return find_cdkey_path();
+#endif
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+// Config files live in ~/.utquery/ (created on first use), or the current
+// directory on Windows.
+std::string get_config_path();        // servers.json
+std::string get_offline_cache_path(); // offline.json (NegativeCache state)
+std::string get_history_dir();        // history/ (HistoryStore)
+
+// First readable cdkey file (~/.ut2004/cdkey, ~/.utquery/cdkey, ./cdkey).
+std::string get_cdkey_path();
@@ -1,4 +1,6 @@
 #include "query.h"
+#include "pacer.h"
+#include "resolver.h"
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -7,15 +9,27 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <poll.h>
 #include <unistd.h>
 #endif
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 
 #ifdef _WIN32
 using socket_t = SOCKET;
+using socklen_t = int;
 static constexpr socket_t SOCKET_INVALID = INVALID_SOCKET;
 #else
 using socket_t = int;
@@ -85,49 +99,211 @@ void query_cleanup() {
 #endif
 }
 
+// ---------------------------------------------------------------------------
+// Sockets and packet counters
+// ---------------------------------------------------------------------------
+
+static std::atomic<uint64_t> stat_sent{0}, stat_received{0}, stat_timed_out{0}, stat_dropped{0};
+static std::atomic<uint64_t> stat_socket_errors{0}, stat_unresolved{0};
+
+QueryStats query_stats() {
+    QueryStats s;
+    s.sent = stat_sent.load();
+    s.received = stat_received.load();
+    s.timed_out = stat_timed_out.load();
+    s.dropped = stat_dropped.load();
+    s.socket_errors = stat_socket_errors.load();
+    s.unresolved = stat_unresolved.load();
+    return s;
+}
+
+// What a queued reply datagram costs against SO_RCVBUF: payload (replies
+// stay under ~1400 bytes) plus the kernel's per-packet overhead.
+static constexpr int REPLY_BUFFER_COST = 2048;
+
+// Open a UDP socket whose receive buffer holds `burst_packets` replies
+// (grown only; a larger system default is kept) and, where supported,
+// reports kernel drops through SO_RXQ_OVFL and receive times through
+// SO_TIMESTAMPNS.
+static socket_t open_query_socket(int burst_packets) {
+    socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == SOCKET_INVALID) return sock;
+
+    int want = burst_packets * REPLY_BUFFER_COST;
+    int have = 0;
+    socklen_t len = sizeof(have);
+    if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char*>(&have), &len) == 0 &&
+        have < want)
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&want), sizeof(want));
+    int on = 1;
+    (void)on;
+#ifdef SO_RXQ_OVFL
+    setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+#endif
+#ifdef SO_TIMESTAMPNS
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+#endif
+    return sock;
+}
+
+// Wall clock in nanoseconds, the clock of SO_TIMESTAMPNS receive stamps.
+static int64_t wall_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// When a query went out, on both clocks: receive stamps are wall clock, but
+// only the steady clock is safe from NTP steps.
+struct SendTime {
+    int64_t wall_ns = 0;
+    std::chrono::steady_clock::time_point steady{};
+};
+
+static SendTime send_time() {
+    return {wall_ns(), std::chrono::steady_clock::now()};
+}
+
+// Round trip of a reply stamped `rx_ns` (wall_ns() clock, see recv_packet())
+// to a query sent at `sent`; call soon after receiving it. Negative if the
+// reply arrived before the query went out (left over from an earlier one).
+// If the wall clock stepped since the send, the stamp can't be compared, so
+// the steady time until now is used instead (never negative).
+static int64_t round_trip(const SendTime& sent, int64_t rx_ns) {
+    int64_t steady = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - sent.steady).count();
+    int64_t wall = wall_ns() - sent.wall_ns;
+    if (std::abs(wall - steady) > 1000000) return steady;
+    return rx_ns - sent.wall_ns;
+}
+
+static void send_packet(socket_t sock, const void* data, size_t len, const sockaddr_in& addr) {
+    sendto(sock, reinterpret_cast<const char*>(data), static_cast<int>(len), 0,
+           reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    ++stat_sent;
+}
+
+// recvfrom() that also counts the packet and, with SO_RXQ_OVFL, the replies
+// the kernel dropped on this socket since the last call. `drops` holds the
+// socket's cumulative drop count; the kernel reports it with each packet, so
+// drops followed by silence go unnoticed. `rx_ns` receives the wall_ns()
+// time the packet arrived: the kernel's stamp with SO_TIMESTAMPNS, which
+// leaves out poll() wakeup and scheduling delays, else the time now.
+static int recv_packet(socket_t sock, void* buf, size_t buf_size, sockaddr_in* from,
+                       uint32_t& drops, int64_t* rx_ns = nullptr) {
+#ifndef _WIN32
+    sockaddr_in addr{};
+    iovec iov{buf, buf_size};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(timespec))];
+    msghdr msg{};
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    int n = static_cast<int>(recvmsg(sock, &msg, 0));
+    if (n < 0) return n;
+    int64_t stamp = 0;
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET) continue;
+#ifdef SO_RXQ_OVFL
+        if (c->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t total;
+            std::memcpy(&total, CMSG_DATA(c), sizeof(total));
+            if (total > drops) {
+                stat_dropped += total - drops;
+                drops = total;
+            }
+        }
+#endif
+#ifdef SCM_TIMESTAMPNS
+        if (c->cmsg_type == SCM_TIMESTAMPNS) {
+            timespec ts;
+            std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            stamp = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        }
+#endif
+    }
+    if (from) *from = addr;
+    if (rx_ns) *rx_ns = stamp ? stamp : wall_ns();
+#else
+    (void)drops;
+    socklen_t from_len = sizeof(sockaddr_in);
+    int n = recvfrom(sock, reinterpret_cast<char*>(buf), static_cast<int>(buf_size), 0,
+                     reinterpret_cast<sockaddr*>(from), from ? &from_len : nullptr);
+    if (n < 0) return n;
+    if (rx_ns) *rx_ns = wall_ns();
+#endif
+    ++stat_received;
+    return n;
+}
+
+// Wait up to `wait` for a packet on `sock`. poll() rather than select() on
+// POSIX: each query has its own socket, and with a high --concurrency their
+// descriptors pass FD_SETSIZE, which an fd_set can't hold.
+static bool wait_readable(socket_t sock, std::chrono::microseconds wait) {
+#ifdef _WIN32
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    timeval tv;
+    tv.tv_sec = static_cast<long>(wait.count() / 1000000);
+    tv.tv_usec = static_cast<long>(wait.count() % 1000000);
+    return select(0, &fds, nullptr, nullptr, &tv) > 0;
+#else
+    pollfd pfd{};
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    // Round up: poll() counts whole milliseconds
+    return poll(&pfd, 1, static_cast<int>((wait.count() + 999) / 1000)) > 0;
+#endif
+}
+
 // Send a UT2004 query packet and receive response.
 // Returns number of bytes received, or -1 on error/timeout.
-// Validates that the response query type matches; drains stale packets.
+// Validates that the response comes from `addr` and its query type matches;
+// drains stale packets.
+// `rtt_ns`, if given, receives the round-trip time of the reply.
 static int send_query(socket_t sock, const sockaddr_in& addr, uint8_t query_type,
-                      uint8_t* buf, size_t buf_size) {
+                      uint8_t* buf, size_t buf_size, uint32_t& drops,
+                      std::chrono::milliseconds timeout, int64_t* rtt_ns = nullptr) {
     uint8_t packet[5] = {0x78, 0x00, 0x00, 0x00, query_type};
-    sendto(sock, reinterpret_cast<const char*>(packet), 5, 0,
-           reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    send_pacer().acquire(addr.sin_addr.s_addr);
+    SendTime sent = send_time();
+    send_packet(sock, packet, sizeof(packet), addr);
 
     // Keep reading packets until we get one matching our query type or timeout
-    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    auto deadline = std::chrono::steady_clock::now() + timeout;
     for (;;) {
         auto now = std::chrono::steady_clock::now();
         auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now);
         if (remaining.count() <= 0) return -1;
 
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(sock, &fds);
-        timeval tv;
-        tv.tv_sec = static_cast<long>(remaining.count() / 1000000);
-        tv.tv_usec = static_cast<long>(remaining.count() % 1000000);
+        if (!wait_readable(sock, remaining)) return -1;
 
-#ifdef _WIN32
-        int sel = select(0, &fds, nullptr, nullptr, &tv);
-#else
-        int sel = select(sock + 1, &fds, nullptr, nullptr, &tv);
-#endif
-        if (sel <= 0) return -1;
-
-        int n = recvfrom(sock, reinterpret_cast<char*>(buf), static_cast<int>(buf_size), 0,
-                         nullptr, nullptr);
+        sockaddr_in from{};
+        int64_t rx_ns;
+        int n = recv_packet(sock, buf, buf_size, &from, drops, &rx_ns);
         if (n < 5) continue;
+        // Late replies from another candidate port, or queued before this
+        // query went out (e.g. the previous ping sample's), aren't ours
+        if (from.sin_addr.s_addr != addr.sin_addr.s_addr || from.sin_port != addr.sin_port)
+            continue;
+        int64_t rtt = round_trip(sent, rx_ns);
+        if (rtt < 0) continue;
 
         // Response header: 0x80 0x00 0x00 0x00 <query_type>
-        if (buf[4] == query_type)
+        if (buf[4] == query_type) {
+            if (rtt_ns) *rtt_ns = rtt;
             return n;
+        }
         // Wrong query type — stale packet from a previous query, drain and retry
     }
 }
 
 static void parse_players(ServerInfo& info, const uint8_t* data, int len) {
     if (len < 5) return;
+    auto& players = info.players.mutate();
 
     int offset = 5; // skip header
     while (offset + 4 < len) {
@@ -160,7 +336,7 @@ static void parse_players(ServerInfo& info, const uint8_t* data, int len) {
             else if (team_raw == 0x40000000) team = 1;  // blue
             else if (team_raw == 0) team = 2;            // spectator (no team)
             else team = 2;                               // spectator/other
-            info.players.push_back({name, score, team});
+            players.push_back({name, score, team});
         }
     }
 }
@@ -198,97 +374,531 @@ static void parse_server_info(ServerInfo& info, const uint8_t* data, int len) {
 
 static void parse_variables(ServerInfo& info, const uint8_t* data, int len) {
     auto parts = split_nulls(data, len);
+    auto& variables = info.variables.mutate();
 
     // Variables come as key-value pairs starting at index 3, step 2
     for (size_t i = 3; i + 1 < parts.size(); i += 2) {
         std::string key = strip_control_chars(parts[i]);
         std::string val = strip_control_chars(parts[i + 1]);
         if (!key.empty()) {
-            info.variables.emplace(key, val);
+            variables.emplace(key, val);
         }
     }
 }
 
-ServerInfo query_server(const std::string& ip, uint16_t game_port) {
+// Query port that last answered, per "ip:game_port", and the round trip of
+// that reply. Shared by all queries so a server with a non-standard port is
+// only searched for once.
+struct QueryEndpoint {
+    uint16_t port = 0; // 0 = unknown
+    int64_t rtt_ns = 0;
+};
+static std::mutex endpoint_mutex;
+static std::unordered_map<std::string, QueryEndpoint> endpoint_memo;
+
+static QueryEndpoint remembered_endpoint(const std::string& key) {
+    std::lock_guard<std::mutex> lock(endpoint_mutex);
+    auto it = endpoint_memo.find(key);
+    return it == endpoint_memo.end() ? QueryEndpoint{} : it->second;
+}
+
+static void remember_endpoint(const std::string& key, QueryEndpoint endpoint) {
+    std::lock_guard<std::mutex> lock(endpoint_mutex);
+    if (endpoint.port)
+        endpoint_memo[key] = endpoint;
+    else
+        endpoint_memo.erase(key);
+}
+
+// 64-bit hash of a reply packet (xxHash64-style multiply/rotate rounds, 8
+// bytes at a time). Chain packets by passing the previous hash as `seed`.
+static uint64_t hash_bytes(const uint8_t* data, size_t len, uint64_t seed = 0) {
+    constexpr uint64_t P1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    uint64_t h = seed + P2 + len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t k;
+        std::memcpy(&k, data + i, 8);
+        h ^= rotl(k * P2, 31) * P1;
+        h = rotl(h, 27) * P1 + P2;
+    }
+    for (; i < len; ++i) {
+        h ^= data[i] * P1;
+        h = rotl(h, 11) * P2;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    return h;
+}
+
+// Last parsed reply per "ip:game_port" and query type, with the hash of its
+// raw packets. Auto-refresh mostly gets byte-identical replies (rules nearly
+// always); those reuse the previous parse instead of decoding it again. The
+// parse is shared with the results built from it (players and rules are
+// SharedSection), so a memo entry costs no second copy while a result holds
+// it. Least recently used entries are dropped first.
+struct ParsedSection {
+    uint64_t hash = 0;
+    std::shared_ptr<const ServerInfo> parsed;
+    std::list<std::string>::iterator lru; // position in section_lru
+};
+static std::mutex section_mutex;
+static std::unordered_map<std::string, ParsedSection> section_memo;
+static std::list<std::string> section_lru; // most recently used first
+static constexpr size_t SECTION_MEMO_MAX = 65536;
+
+// Fill `info` from the reply with hash `hash`: take the sections from the
+// previous parse if the reply is identical, otherwise parse() it and keep
+// the result. copy(to, from) assigns the section's fields.
+template <class Parse, class Copy>
+static void parse_section(const std::string& key, uint64_t hash, ServerInfo& info,
+                          Parse parse, Copy copy) {
+    std::shared_ptr<const ServerInfo> parsed;
+    {
+        std::lock_guard<std::mutex> lock(section_mutex);
+        auto it = section_memo.find(key);
+        if (it != section_memo.end() && it->second.hash == hash) {
+            section_lru.splice(section_lru.begin(), section_lru, it->second.lru);
+            parsed = it->second.parsed;
+        }
+    }
+    if (parsed) {
+        copy(info, *parsed);
+        return;
+    }
+    auto fresh = std::make_shared<ServerInfo>();
+    parse(*fresh);
+    copy(info, *fresh);
+    parsed = std::move(fresh);
+
+    std::lock_guard<std::mutex> lock(section_mutex);
+    auto [it, inserted] = section_memo.try_emplace(key);
+    if (inserted) {
+        section_lru.push_front(key);
+        it->second.lru = section_lru.begin();
+    } else {
+        section_lru.splice(section_lru.begin(), section_lru, it->second.lru);
+    }
+    it->second.hash = hash;
+    it->second.parsed = std::move(parsed);
+    while (section_memo.size() > SECTION_MEMO_MAX) {
+        section_memo.erase(section_lru.back());
+        section_lru.pop_back();
+    }
+}
+
+static void copy_info_section(ServerInfo& to, const ServerInfo& from) {
+    to.name = from.name;
+    to.map_name = from.map_name;
+    to.map_title = from.map_title;
+    to.gametype = from.gametype;
+    to.num_players = from.num_players;
+    to.max_players = from.max_players;
+    to.flags = from.flags;
+    to.skill = from.skill;
+}
+
+static void copy_players_section(ServerInfo& to, const ServerInfo& from) {
+    to.players = from.players;
+}
+
+static void copy_rules_section(ServerInfo& to, const ServerInfo& from) {
+    to.variables = from.variables;
+}
+
+// Set ping (median), ping_min and ping_jitter (mean difference between
+// consecutive samples, as in RFC 3550) from round-trip times in ns.
+static void set_ping(ServerInfo& info, std::vector<int64_t> rtts) {
+    if (rtts.empty()) return;
+    // round_trip() is negative for a reply that was already queued; clamp
+    // rather than report a negative ping
+    for (auto& r : rtts) r = std::max<int64_t>(r, 0);
+    int64_t jitter = 0;
+    for (size_t i = 1; i < rtts.size(); ++i)
+        jitter += std::abs(rtts[i] - rtts[i - 1]);
+    if (rtts.size() > 1) jitter /= static_cast<int64_t>(rtts.size() - 1);
+
+    std::sort(rtts.begin(), rtts.end());
+    size_t mid = rtts.size() / 2;
+    int64_t median = rtts.size() % 2 ? rtts[mid] : (rtts[mid - 1] + rtts[mid]) / 2;
+    auto to_ms = [](int64_t ns) { return static_cast<int32_t>((ns + 500000) / 1000000); };
+    info.ping = to_ms(median);
+    info.ping_min = to_ms(rtts.front());
+    info.ping_jitter = to_ms(jitter);
+    info.ping_samples = static_cast<uint8_t>(std::min<size_t>(rtts.size(), 255));
+}
+
+// Send the 0x00 info query to every candidate port at once and return the
+// first reply (bytes received, or -1 on timeout). `answered_port` receives the
+// port that replied, `rtt_ns` its round trip (see round_trip()). The caller
+// acquires pacing tokens for all of them.
+static int probe_info(socket_t sock, sockaddr_in addr, const std::vector<uint16_t>& ports,
+                      uint8_t* buf, size_t buf_size, uint16_t& answered_port,
+                      uint32_t& drops, int64_t& rtt_ns, std::chrono::milliseconds timeout) {
+    uint8_t packet[5] = {0x78, 0x00, 0x00, 0x00, 0x00};
+    SendTime sent = send_time();
+    for (uint16_t port : ports) {
+        addr.sin_port = htons(port);
+        send_packet(sock, packet, sizeof(packet), addr);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+        auto now = std::chrono::steady_clock::now();
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now);
+        if (remaining.count() <= 0) return -1;
+
+        if (!wait_readable(sock, remaining)) return -1;
+
+        sockaddr_in from{};
+        int64_t rx_ns;
+        int n = recv_packet(sock, buf, buf_size, &from, drops, &rx_ns);
+        if (n < 5 || buf[4] != 0x00) continue;
+        if (from.sin_addr.s_addr != addr.sin_addr.s_addr) continue;
+
+        uint16_t port = ntohs(from.sin_port);
+        if (std::find(ports.begin(), ports.end(), port) == ports.end()) continue;
+        answered_port = port;
+        // A late reply to an earlier probe still tells the port is up
+        rtt_ns = std::max<int64_t>(round_trip(sent, rx_ns), 0);
+        return n;
+    }
+}
+
+// Native UT2004 protocol: three binary queries (info, players, rules).
+static ServerInfo query_native(const std::string& ip, uint16_t game_port, const QueryOptions& opts) {
     ServerInfo info;
     info.address = ip;
     info.port = game_port;
     info.status = "querying";
 
-    uint16_t query_port = game_port + 1;
+    // Candidate query ports: the master-reported one, then the usual game_port+1,
+    // then +10 (GameSpy port). A port that answered before is tried alone first,
+    // for a few of its last round trips, then together with the others.
+    std::vector<uint16_t> candidates;
+    auto add_candidate = [&candidates](uint32_t port) {
+        if (port == 0 || port > 65535) return;
+        if (std::find(candidates.begin(), candidates.end(), port) == candidates.end())
+            candidates.push_back(static_cast<uint16_t>(port));
+    };
+    add_candidate(opts.query_port);
+    add_candidate(game_port + 1u);
+    add_candidate(game_port + 10u);
 
-    socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    std::string endpoint_key = ip + ":" + std::to_string(game_port);
+    QueryEndpoint known = remembered_endpoint(endpoint_key);
+    uint16_t remembered = known.port;
+    info.query_port = remembered ? remembered : candidates.front();
+    if (remembered) add_candidate(remembered);
+
+    // Late info replies from every candidate port may still be queued
+    // behind a multi-packet player list and the rules
+    socket_t sock = open_query_socket(static_cast<int>(candidates.size()) + 10);
     if (sock == SOCKET_INVALID) {
         info.status = "socket error";
         return info;
     }
+    uint32_t drops = 0;
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(query_port);
     inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
 
     uint8_t buf[65535];
 
+    // Query 0x00: server info — finds the query port and takes the first ping
+    // sample. A server that doesn't answer this won't answer the player/rules
+    // queries either, so they are skipped.
+    // Pacing waits happen before the clock starts so they don't count as ping.
+    uint16_t answered_port = 0;
+    int64_t rtt = 0;
+    int n = -1;
+    // Both probes together take at most opts.timeout, so a server that moved
+    // ports or went down costs no more than one that was never seen
+    auto probe_timeout = opts.timeout;
+    if (remembered) {
+        auto solo = std::min(opts.timeout,
+                             std::max(std::chrono::milliseconds(50),
+                                      std::chrono::duration_cast<std::chrono::milliseconds>(
+                                          std::chrono::nanoseconds(known.rtt_ns)) * 4));
+        send_pacer().acquire(addr.sin_addr.s_addr);
+        n = probe_info(sock, addr, {remembered}, buf, sizeof(buf), answered_port, drops,
+                       rtt, solo);
+        probe_timeout -= solo;
+    }
+    if (n <= 0 && probe_timeout.count() > 0) {
+        // The remembered port is asked again too; its late reply still counts
+        send_pacer().acquire(addr.sin_addr.s_addr, static_cast<int>(candidates.size()));
+        n = probe_info(sock, addr, candidates, buf, sizeof(buf), answered_port, drops,
+                       rtt, probe_timeout);
+    }
+    std::vector<int64_t> rtts;
+
+    if (n > 0) {
+        info.info_hash = hash_bytes(buf, n);
+        parse_section(endpoint_key + "/info", info.info_hash, info,
+                      [&](ServerInfo& out) { parse_server_info(out, buf, n); },
+                      copy_info_section);
+        info.online = true;
+        rtts.push_back(rtt);
+        info.query_port = answered_port;
+        remember_endpoint(endpoint_key, {answered_port, rtt});
+    } else if (remembered) {
+        remember_endpoint(endpoint_key, {});
+    }
+    addr.sin_port = htons(info.query_port);
+
+    // List queries stop at the info reply
+    info.sections = query_profile_sections(opts.profile);
+    bool detail = opts.profile == QueryProfile::Detail;
+
     // Query 0x02: players — UT2004 may split across multiple UDP packets
-    {
+    if (info.online && detail) {
         uint8_t packet[5] = {0x78, 0x00, 0x00, 0x00, 0x02};
-        sendto(sock, reinterpret_cast<const char*>(packet), 5, 0,
-               reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+        send_pacer().acquire(addr.sin_addr.s_addr);
+        send_packet(sock, packet, sizeof(packet), addr);
 
-        // Collect all player response packets until timeout
-        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        // Collect all player response packets until timeout; parsed together
+        // afterwards unless identical to the last reply
+        std::vector<std::vector<uint8_t>> packets;
+        uint64_t hash = 0;
+        auto deadline = std::chrono::steady_clock::now() + opts.timeout;
         bool got_first = false;
         for (;;) {
             auto now = std::chrono::steady_clock::now();
             auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now);
             if (remaining.count() <= 0) break;
 
-            fd_set fds;
-            FD_ZERO(&fds);
-            FD_SET(sock, &fds);
-            timeval tv;
             // After first packet, use short timeout to catch follow-up packets
-            if (got_first) {
-                tv.tv_sec = 0;
-                tv.tv_usec = 200000; // 200ms between packets
-            } else {
-                tv.tv_sec = static_cast<long>(remaining.count() / 1000000);
-                tv.tv_usec = static_cast<long>(remaining.count() % 1000000);
-            }
+            auto wait = got_first ? std::chrono::microseconds(200000) // 200ms between packets
+                                  : remaining;
+            if (!wait_readable(sock, wait)) break;
+
+            int len = recv_packet(sock, buf, sizeof(buf), nullptr, drops);
+            if (len < 5) continue;
+            if (buf[4] != 0x02) continue; // drain stale packets
+
+            packets.emplace_back(buf, buf + len);
+            hash = hash_bytes(buf, len, hash);
+            got_first = true;
+        }
+        // The server just answered info, so silence here is likely loss
+        send_pacer().report(got_first);
+
+        info.players_hash = hash;
+        parse_section(endpoint_key + "/players", hash, info,
+                      [&](ServerInfo& out) {
+                          for (auto& p : packets)
+                              parse_players(out, p.data(), static_cast<int>(p.size()));
+                      },
+                      copy_players_section);
+    }
+
+    // Query 0x01: variables
+    if (info.online && detail) {
+        n = send_query(sock, addr, 0x01, buf, sizeof(buf), drops, opts.timeout);
+        send_pacer().report(n > 0);
+        if (n > 0) {
+            info.rules_hash = hash_bytes(buf, n);
+            parse_section(endpoint_key + "/rules", info.rules_hash, info,
+                          [&](ServerInfo& out) { parse_variables(out, buf, n); },
+                          copy_rules_section);
+        }
+    }
+
+    // More info queries if asked for, spaced apart, so one slow server frame
+    // or a late wakeup on our side doesn't decide the ping. The server just
+    // answered, so each waits a few first round trips, not the full timeout.
+    if (info.online) {
+        auto first = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::nanoseconds(std::max<int64_t>(rtts.front(), 0)));
+        auto sample_timeout = std::min(opts.timeout,
+                                       std::max(std::chrono::milliseconds(50), first * 4));
+        for (int i = 1; i < opts.ping_samples; ++i) {
+            std::this_thread::sleep_for(opts.ping_spacing);
+            int64_t rtt;
+            if (send_query(sock, addr, 0x00, buf, sizeof(buf), drops, sample_timeout, &rtt) > 0)
+                rtts.push_back(rtt);
+        }
+        set_ping(info, rtts);
+    }
+    if (!info.online)
+        info.info_hash = info.players_hash = info.rules_hash = 0;
 
 #ifdef _WIN32
-            int sel = select(0, &fds, nullptr, nullptr, &tv);
+    closesocket(sock);
 #else
-            int sel = select(sock + 1, &fds, nullptr, nullptr, &tv);
+    close(sock);
 #endif
-            if (sel <= 0) break;
 
-            int n = recvfrom(sock, reinterpret_cast<char*>(buf), static_cast<int>(sizeof(buf)), 0,
-                             nullptr, nullptr);
-            if (n < 5) continue;
-            if (buf[4] != 0x02) continue; // drain stale packets
+    return info;
+}
 
-            parse_players(info, buf, n);
-            got_first = true;
+// ---------------------------------------------------------------------------
+// GameSpy protocol
+// ---------------------------------------------------------------------------
+
+// Split a backslash-delimited GameSpy reply ("\key\value\key\value...")
+// into key/value pairs appended to `out`.
+static void split_gamespy(const char* data, size_t len,
+                          std::vector<std::pair<std::string, std::string>>& out) {
+    std::vector<std::string> tokens;
+    size_t start = (len > 0 && data[0] == '\\') ? 1 : 0;
+    for (size_t i = start; i <= len; ++i) {
+        if (i == len || data[i] == '\\') {
+            tokens.emplace_back(data + start, i - start);
+            start = i + 1;
         }
     }
+    for (size_t i = 0; i + 1 < tokens.size(); i += 2)
+        out.emplace_back(std::move(tokens[i]), std::move(tokens[i + 1]));
+}
 
-    // Query 0x00: server info — measure ping from this single round-trip
-    auto ping_start = std::chrono::steady_clock::now();
-    int n = send_query(sock, addr, 0x00, buf, sizeof(buf));
-    auto ping_end = std::chrono::steady_clock::now();
-    if (n > 0) {
-        parse_server_info(info, buf, n);
-        info.online = true;
-        info.ping = static_cast<int32_t>(
-            std::chrono::duration_cast<std::chrono::milliseconds>(ping_end - ping_start).count());
+static void parse_gamespy(ServerInfo& info,
+                          const std::vector<std::pair<std::string, std::string>>& kv) {
+    struct Slot { std::string name; int32_t score = 0; int team = -1; bool seen = false; };
+    std::vector<Slot> slots;
+    auto slot = [&slots](const std::string& key, size_t prefix_len) -> Slot* {
+        int idx = std::atoi(key.c_str() + prefix_len);
+        if (idx < 0 || idx > 255) return nullptr;
+        if (static_cast<size_t>(idx) >= slots.size()) slots.resize(idx + 1);
+        return &slots[idx];
+    };
+
+    for (auto& [raw_key, raw_val] : kv) {
+        std::string key = raw_key;
+        for (auto& c : key) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        std::string val = strip_control_chars(raw_val);
+
+        if (key.rfind("player_", 0) == 0) {
+            if (Slot* p = slot(key, 7)) { p->name = val; p->seen = true; }
+        } else if (key.rfind("frags_", 0) == 0 || key.rfind("score_", 0) == 0) {
+            if (Slot* p = slot(key, 6)) p->score = std::atoi(val.c_str());
+        } else if (key.rfind("team_", 0) == 0) {
+            if (Slot* p = slot(key, 5)) p->team = std::atoi(val.c_str());
+        } else if (key.rfind("ping_", 0) == 0 || key.rfind("mesh_", 0) == 0 ||
+                   key.rfind("skin_", 0) == 0 || key.rfind("face_", 0) == 0 ||
+                   key.rfind("ngsecret_", 0) == 0 || key.rfind("deaths_", 0) == 0) {
+            // Per-player fields we don't show
+        } else if (key == "hostname") {
+            info.name = val;
+        } else if (key == "mapname") {
+            info.map_name = val;
+        } else if (key == "maptitle") {
+            info.map_title = val;
+        } else if (key == "gametype") {
+            info.gametype = val;
+        } else if (key == "numplayers") {
+            info.num_players = std::atoi(val.c_str());
+        } else if (key == "maxplayers") {
+            info.max_players = std::atoi(val.c_str());
+        } else if (!key.empty()) {
+            info.variables.mutate().emplace(raw_key, val);
+        }
     }
 
-    // Query 0x01: variables
-    n = send_query(sock, addr, 0x01, buf, sizeof(buf));
-    if (n > 0) {
-        parse_variables(info, buf, n);
+    for (auto& p : slots) {
+        if (!p.seen || p.name.empty()) continue;
+        // GameSpy teams are 0=red, 1=blue; anything else is a spectator
+        int team = p.team == 0 ? 0 : (p.team == 1 ? 1 : (p.team < 0 ? -1 : 2));
+        info.players.mutate().push_back({p.name, p.score, team});
+    }
+}
+
+// GameSpy-style text query on the server's GameSpy port. One request returns
+// info, rules and players, possibly split over several packets tagged
+// "\queryid\<id>.<n>"; the last one also carries "\final\".
+static ServerInfo query_gamespy(const std::string& ip, uint16_t game_port, const QueryOptions& opts) {
+    ServerInfo info;
+    info.address = ip;
+    info.port = game_port;
+    info.status = "querying";
+    info.query_port = opts.gamespy_port ? opts.gamespy_port
+                                        : static_cast<uint16_t>(game_port + 10);
+
+    // The reply is split into up to a dozen or so packets
+    socket_t sock = open_query_socket(16);
+    if (sock == SOCKET_INVALID) {
+        info.status = "socket error";
+        return info;
+    }
+    uint32_t drops = 0;
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(info.query_port);
+    inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+
+    // List queries ask for the info keys only
+    bool detail = opts.profile == QueryProfile::Detail;
+    info.sections = query_profile_sections(opts.profile);
+    std::string_view request = detail ? "\\info\\\\rules\\\\players\\" : "\\info\\";
+    send_pacer().acquire(addr.sin_addr.s_addr);
+    SendTime sent = send_time();
+    send_packet(sock, request.data(), request.size(), addr);
+
+    // Packets by sequence number (1-based); reassembled in order once the
+    // final packet and everything before it has arrived.
+    std::map<int, std::vector<std::pair<std::string, std::string>>> packets;
+    std::map<int, uint64_t> packet_hashes;
+    int final_seq = 0;
+    char buf[65535];
+    auto deadline = sent.steady + opts.timeout;
+    for (;;) {
+        if (final_seq > 0 && static_cast<int>(packets.size()) >= final_seq) break;
+
+        auto now = std::chrono::steady_clock::now();
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now);
+        if (remaining.count() <= 0) break;
+
+        if (!wait_readable(sock, remaining)) break;
+
+        int64_t rx_ns;
+        int n = recv_packet(sock, buf, sizeof(buf), nullptr, drops, &rx_ns);
+        if (n <= 0 || buf[0] != '\\') continue;
+
+        // One sample: a second full GameSpy exchange would cost far more
+        // than it is worth
+        if (packets.empty()) set_ping(info, {round_trip(sent, rx_ns)});
+
+        std::vector<std::pair<std::string, std::string>> kv;
+        split_gamespy(buf, static_cast<size_t>(n), kv);
+        int seq = 1;
+        bool is_final = false;
+        for (auto it = kv.begin(); it != kv.end();) {
+            if (it->first == "queryid") {
+                auto dot = it->second.find('.');
+                if (dot != std::string::npos) seq = std::max(1, std::atoi(it->second.c_str() + dot + 1));
+                it = kv.erase(it);
+            } else if (it->first == "final") {
+                is_final = true;
+                it = kv.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        // "\final\" is usually the last token and has no value, so split_gamespy
+        // may have dropped it as an unpaired key
+        std::string_view tail(buf, static_cast<size_t>(n));
+        if (tail.find("\\final\\") != std::string_view::npos) is_final = true;
+
+        if (is_final) final_seq = seq;
+        packets[seq] = std::move(kv);
+        // Hashed without the "\queryid\<id>.<n>" tag, whose id changes with
+        // every request
+        auto bytes = reinterpret_cast<const uint8_t*>(buf);
+        size_t qid = tail.find("\\queryid\\");
+        if (qid == std::string_view::npos) {
+            packet_hashes[seq] = hash_bytes(bytes, tail.size());
+        } else {
+            size_t rest = tail.find('\\', qid + 9);
+            if (rest == std::string_view::npos) rest = tail.size();
+            packet_hashes[seq] = hash_bytes(bytes + rest, tail.size() - rest,
+                                            hash_bytes(bytes, qid));
+        }
     }
 
 #ifdef _WIN32
@@ -297,6 +907,230 @@ ServerInfo query_server(const std::string& ip, uint16_t game_port) {
     close(sock);
 #endif
 
-    info.status = info.online ? "online" : "timeout";
+    if (packets.empty()) return info;
+
+    // One reply holds every section, so it is reused or parsed as a whole
+    uint64_t hash = 0;
+    for (auto& [seq, h] : packet_hashes)
+        hash = hash_bytes(reinterpret_cast<const uint8_t*>(&h), sizeof(h), hash);
+    std::string key = ip + ":" + std::to_string(game_port) + (detail ? "/gamespy" : "/gamespy-info");
+    parse_section(key, hash, info,
+        [&](ServerInfo& out) {
+            std::vector<std::pair<std::string, std::string>> all;
+            for (auto& [seq, kv] : packets)
+                all.insert(all.end(), kv.begin(), kv.end());
+            parse_gamespy(out, all);
+        },
+        [detail](ServerInfo& to, const ServerInfo& from) {
+            copy_info_section(to, from);
+            if (!detail) return; // whatever else the server sent
+            copy_players_section(to, from);
+            copy_rules_section(to, from);
+        });
+    info.info_hash = hash;
+    if (detail) info.players_hash = info.rules_hash = hash;
+    info.online = true;
+    return info;
+}
+
+// ---------------------------------------------------------------------------
+// Ping sweep
+// ---------------------------------------------------------------------------
+
+void sweep_servers(const std::vector<SweepTarget>& targets, const QueryOptions& opts,
+                   const std::function<void(size_t index, const ServerInfo&)>& done) {
+    struct Pending {
+        size_t index;
+        std::string ip, endpoint_key;
+        SendTime sent;
+    };
+    // Outstanding queries by (IPv4 << 16 | query port); a target listed twice
+    // shares the reply
+    std::unordered_map<uint64_t, std::vector<Pending>> pending;
+
+    auto result = [&](const SweepTarget& t, const std::string& ip) {
+        ServerInfo info;
+        info.address = t.host;
+        info.ip = ip;
+        info.port = t.port;
+        info.sections = SECTION_INFO;
+        return info;
+    };
+
+    // Replies can pile up while the pacer holds back the next send
+    socket_t sock = open_query_socket(static_cast<int>(std::min<size_t>(targets.size(), 4096)));
+    uint32_t drops = 0;
+    uint8_t buf[65535];
+
+    // Take every reply already queued (wait 0) or that arrives within `wait`
+    auto receive = [&](std::chrono::microseconds wait) {
+        for (;;) {
+            if (!wait_readable(sock, wait)) return;
+            wait = std::chrono::microseconds(0);
+
+            sockaddr_in from{};
+            int64_t rx_ns;
+            int n = recv_packet(sock, buf, sizeof(buf), &from, drops, &rx_ns);
+            if (n < 5 || buf[4] != 0x00) continue;
+            uint64_t key = static_cast<uint64_t>(ntohl(from.sin_addr.s_addr)) << 16 |
+                           ntohs(from.sin_port);
+            auto it = pending.find(key);
+            if (it == pending.end()) continue;
+
+            uint64_t hash = hash_bytes(buf, n);
+            for (auto& p : it->second) {
+                ServerInfo info = result(targets[p.index], p.ip);
+                info.query_port = ntohs(from.sin_port);
+                info.info_hash = hash;
+                parse_section(p.endpoint_key + "/info", hash, info,
+                              [&](ServerInfo& out) { parse_server_info(out, buf, n); },
+                              copy_info_section);
+                info.online = true;
+                info.status = "online";
+                int64_t rtt = round_trip(p.sent, rx_ns);
+                set_ping(info, {rtt});
+                info.queried_at = std::chrono::steady_clock::now();
+                remember_endpoint(p.endpoint_key, {info.query_port, rtt});
+                done(p.index, info);
+            }
+            pending.erase(it);
+        }
+    };
+
+    for (auto& t : targets)
+        dns_resolver().prefetch(t.host);
+
+    auto last_send = std::chrono::steady_clock::now();
+    uint8_t packet[5] = {0x78, 0x00, 0x00, 0x00, 0x00};
+    for (size_t i = 0; i < targets.size(); ++i) {
+        auto& t = targets[i];
+        std::string ip = dns_resolver().resolve(t.host);
+        if (ip.empty() || sock == SOCKET_INVALID) {
+            ServerInfo info = result(t, ip);
+            info.status = ip.empty() ? "unresolved" : "socket error";
+            if (ip.empty())
+                ++stat_unresolved;
+            else
+                ++stat_socket_errors;
+            info.queried_at = std::chrono::steady_clock::now();
+            done(i, info);
+            continue;
+        }
+
+        std::string endpoint_key = ip + ":" + std::to_string(t.port);
+        uint16_t port = remembered_endpoint(endpoint_key).port;
+        if (!port) port = t.query_port ? t.query_port : static_cast<uint16_t>(t.port + 1);
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+        uint64_t key = static_cast<uint64_t>(ntohl(addr.sin_addr.s_addr)) << 16 | port;
+
+        auto& waiting = pending[key];
+        bool first = waiting.empty();
+        waiting.push_back({i, ip, std::move(endpoint_key), {}});
+        if (first) {
+            send_pacer().acquire(addr.sin_addr.s_addr);
+            waiting.back().sent = send_time();
+            send_packet(sock, packet, sizeof(packet), addr);
+            last_send = std::chrono::steady_clock::now();
+        } else {
+            waiting.back().sent = waiting.front().sent;
+        }
+        receive(std::chrono::microseconds(0));
+    }
+
+    auto deadline = last_send + opts.timeout;
+    while (!pending.empty()) {
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) break;
+        receive(remaining);
+    }
+
+    if (sock != SOCKET_INVALID) {
+#ifdef _WIN32
+        closesocket(sock);
+#else
+        close(sock);
+#endif
+    }
+
+    for (auto& [key, waiting] : pending) {
+        for (auto& p : waiting) {
+            ServerInfo info = result(targets[p.index], p.ip);
+            info.status = "timeout";
+            info.queried_at = std::chrono::steady_clock::now();
+            ++stat_timed_out;
+            done(p.index, info);
+        }
+    }
+}
+
+ServerInfo query_server(const std::string& host, uint16_t game_port, const QueryOptions& opts) {
+    ServerInfo info;
+    // Hostnames resolve through the shared cache; IPv4 literals pass through
+    std::string ip = dns_resolver().resolve(host);
+    if (ip.empty()) {
+        info.address = host;
+        info.port = game_port;
+        info.status = "unresolved";
+        ++stat_unresolved;
+        info.queried_at = std::chrono::steady_clock::now();
+        return info;
+    }
+
+    switch (opts.protocol) {
+        case QueryProtocol::Native:
+            info = query_native(ip, game_port, opts);
+            break;
+        case QueryProtocol::GameSpy:
+            info = query_gamespy(ip, game_port, opts);
+            break;
+        case QueryProtocol::Auto:
+            info = query_native(ip, game_port, opts);
+            if (!info.online) {
+                ServerInfo gs = query_gamespy(ip, game_port, opts);
+                if (gs.online) info = std::move(gs);
+            }
+            break;
+    }
+
+    info.address = host;
+    info.ip = ip;
+    // A backend that failed locally (e.g. "socket error") says so itself
+    if (info.online)
+        info.status = "online";
+    else if (info.status == "querying")
+        info.status = "timeout";
+    if (info.status == "timeout")
+        ++stat_timed_out;
+    else if (info.status == "socket error")
+        ++stat_socket_errors;
+    info.queried_at = std::chrono::steady_clock::now();
     return info;
 }
+
+uint8_t query_profile_sections(QueryProfile p) {
+    return p == QueryProfile::List ? SECTION_INFO : SECTION_ALL;
+}
+
+const char* query_protocol_name(QueryProtocol p) {
+    switch (p) {
+        case QueryProtocol::Native:  return "native";
+        case QueryProtocol::GameSpy: return "gamespy";
+        case QueryProtocol::Auto:    return "auto";
+    }
+    return "native";
+}
+
+bool parse_query_protocol(const std::string& s, QueryProtocol& out) {
+    for (auto p : {QueryProtocol::Native, QueryProtocol::GameSpy, QueryProtocol::Auto}) {
+        if (s == query_protocol_name(p)) {
+            out = p;
+            return true;
+        }
+    }
+    return false;
+}
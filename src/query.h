@@ -1,7 +1,10 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -11,16 +14,77 @@ struct PlayerInfo {
     int team = -1; // 0=red, 1=blue, 2=spectator, -1=unknown
 };
 
+// A reply section shared by every copy of the ServerInfo it came from (both
+// tabs, the query cache, the reply memo), so copying a result copies a
+// pointer. Read it like the container it holds; mutate() unshares it first.
+template <typename T>
+class SharedSection {
+public:
+    SharedSection() = default;
+    SharedSection(T value) : ptr_(std::make_shared<const T>(std::move(value))) {}
+    SharedSection(std::shared_ptr<const T> ptr) : ptr_(std::move(ptr)) {}
+
+    const T& get() const { return ptr_ ? *ptr_ : empty_value(); }
+    operator const T&() const { return get(); }
+    const std::shared_ptr<const T>& share() const { return ptr_; }
+
+    auto begin() const { return get().begin(); }
+    auto end() const { return get().end(); }
+    size_t size() const { return get().size(); }
+    bool empty() const { return get().empty(); }
+    decltype(auto) operator[](size_t i) const { return get()[i]; }
+
+    T& mutate() {
+        if (!ptr_ || ptr_.use_count() > 1)
+            ptr_ = std::make_shared<const T>(get());
+        // Allocated non-const above or in the constructor
+        return const_cast<T&>(*ptr_);
+    }
+    void clear() { ptr_.reset(); }
+
+    friend bool operator==(const SharedSection& a, const SharedSection& b) {
+        return a.ptr_ == b.ptr_ || a.get() == b.get();
+    }
+
+private:
+    std::shared_ptr<const T> ptr_;
+
+    static const T& empty_value() {
+        static const T empty;
+        return empty;
+    }
+};
+
+// ServerInfo::sections bits: the parts of a server's reply.
+constexpr uint8_t SECTION_INFO = 1;    // name, map, gametype, player counts
+constexpr uint8_t SECTION_PLAYERS = 2;
+constexpr uint8_t SECTION_RULES = 4;
+constexpr uint8_t SECTION_ALL = SECTION_INFO | SECTION_PLAYERS | SECTION_RULES;
+
 struct ServerInfo {
-    std::string address;
+    std::string address;     // as entered: hostname or dotted IPv4
+    std::string ip;          // resolved IPv4 of address (empty if unresolved)
     uint16_t port;
+    uint16_t query_port = 0; // UDP port that answered (or was last tried)
     std::string name, map_title, map_name, gametype;
     int32_t max_players = 0, num_players = 0, ping = 0, flags = 0;
+    // ping is the median round trip in ms over ping_samples samples
+    // (QueryOptions::ping_samples, fewer if some went unanswered); ping_min
+    // the fastest, ping_jitter their mean variation
+    int32_t ping_min = 0, ping_jitter = 0;
+    uint8_t ping_samples = 0;
     uint8_t skill = 0;
-    std::vector<PlayerInfo> players;
-    std::multimap<std::string, std::string> variables;
+    SharedSection<std::vector<PlayerInfo>> players;
+    SharedSection<std::multimap<std::string, std::string>> variables;
     bool online = false;
     std::string status = "idle";
+    // Sections this result was queried for (SECTION_INFO for a sweep); the
+    // others are empty or carried over from an earlier result
+    uint8_t sections = SECTION_ALL;
+    // Hashes of the raw reply per section (0 = unknown); replies with the
+    // same hash parse to the same section
+    uint64_t info_hash = 0, players_hash = 0, rules_hash = 0;
+    std::chrono::steady_clock::time_point queried_at{}; // when the query completed
 };
 
 // Must be called once before any queries (WSAStartup)
@@ -29,6 +93,85 @@ void query_init();
 // Must be called once at shutdown (WSACleanup)
 void query_cleanup();
 
-// Query a UT2004 server. Sends UDP queries to game_port + 1.
+enum class QueryProtocol {
+    Native,  // UT2004 binary queries on the query port (info, players, rules)
+    GameSpy, // one text query (\info\\rules\\players\) on the GameSpy port
+    Auto,    // native, falling back to GameSpy if the server doesn't answer
+};
+
+const char* query_protocol_name(QueryProtocol p);
+bool parse_query_protocol(const std::string& s, QueryProtocol& out);
+
+// How much of a server to query, picked per purpose: List for rows in a
+// server list (name, map, gametype, player counts, ping), Detail when its
+// players and rules are wanted too.
+enum class QueryProfile {
+    List,   // info query only (GameSpy: \info\)
+    Detail, // info, players and rules
+};
+
+// ServerInfo sections a profile queries.
+uint8_t query_profile_sections(QueryProfile p);
+
+struct QueryOptions {
+    QueryProtocol protocol = QueryProtocol::Native;
+    QueryProfile profile = QueryProfile::Detail;
+
+    // Query port reported by the master server, or 0 if unknown. Tried
+    // together with game_port + 1 and game_port + 10; whichever answers is
+    // remembered for later queries of the same server.
+    uint16_t query_port = 0;
+
+    // GameSpy query port, or 0 for game_port + 10.
+    uint16_t gamespy_port = 0;
+
+    // How long to wait for each reply before giving up.
+    std::chrono::milliseconds timeout{2000};
+
+    // Round trips measured for ping (native protocol): the first info query
+    // plus ping_samples - 1 more, each ping_spacing after the previous reply.
+    // Extra samples cost a packet and a wait each, so only queries that are
+    // about the ping ask for them.
+    int ping_samples = 1;
+    std::chrono::milliseconds ping_spacing{50};
+};
+
+// Process-wide totals of the query engine since startup. Compare `dropped`
+// with `timed_out` to tell whether timeouts were our own receive queues
+// overflowing rather than servers not answering. Queries that failed here
+// (no socket, no address) are counted apart from timeouts.
+struct QueryStats {
+    uint64_t sent = 0;          // UDP query packets
+    uint64_t received = 0;      // reply packets (including stale ones)
+    uint64_t timed_out = 0;     // queries that got no answer
+    uint64_t dropped = 0;       // replies the kernel discarded for lack of socket
+                                // buffer space (Linux SO_RXQ_OVFL; 0 elsewhere)
+    uint64_t socket_errors = 0; // queries that couldn't open a socket (e.g. EMFILE)
+    uint64_t unresolved = 0;    // queries whose hostname didn't resolve
+};
+
+QueryStats query_stats();
+
+struct SweepTarget {
+    std::string host;         // hostname or IPv4
+    uint16_t port = 7777;     // game port
+    uint16_t query_port = 0;  // as reported by a master server, 0 if unknown
+};
+
+// Ping sweep: send only the 0x00 info query to every target from a single
+// socket, paced by send_pacer(), and take replies as they arrive — enough
+// to rank a whole master list by reachability, ping and players in seconds.
+// Each target is tried on one port (the one that answered before, else
+// query_port, else port + 1), with one ping sample.
+// `done` is called on the calling thread once per target, in arrival order,
+// with a result whose `sections` is SECTION_INFO (no players or rules);
+// targets without a reply opts.timeout after the last send time out.
+// Blocking.
+void sweep_servers(const std::vector<SweepTarget>& targets, const QueryOptions& opts,
+                   const std::function<void(size_t index, const ServerInfo&)>& done);
+
+// Query a UT2004 server (info, players, rules) using opts.protocol.
+// `host` may be a hostname; it is resolved through dns_resolver().
 // Blocking call — run on a worker thread.
-ServerInfo query_server(const std::string& ip, uint16_t game_port);
+ServerInfo query_server(const std::string& host, uint16_t game_port,
+                        const QueryOptions& opts = {});
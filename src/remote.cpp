@@ -0,0 +1,301 @@
+#include "remote.h"
+#include "output.h"
+#include "resolver.h"
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+
+#ifdef _WIN32
+using socket_t = SOCKET;
+using socklen_t = int;
+static constexpr socket_t SOCKET_INVALID = INVALID_SOCKET;
+#else
+using socket_t = int;
+static constexpr socket_t SOCKET_INVALID = -1;
+#endif
+
+static void close_socket(socket_t s) {
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+// Wait up to `ms` for `events` (POLLIN/POLLOUT) on `s`. Returns poll()'s
+// result: > 0 ready, 0 timeout, < 0 error.
+static int wait_socket(socket_t s, short events, int ms) {
+    pollfd pfd{};
+    pfd.fd = s;
+    pfd.events = events;
+#ifdef _WIN32
+    return WSAPoll(&pfd, 1, ms);
+#else
+    return poll(&pfd, 1, ms);
+#endif
+}
+
+static void set_blocking(socket_t s, bool blocking) {
+#ifdef _WIN32
+    u_long mode = blocking ? 0 : 1;
+    ioctlsocket(s, FIONBIO, &mode);
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    fcntl(s, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+#endif
+}
+
+// Connect without blocking for longer than CONNECT_TIMEOUT, giving up early
+// once `stop` is set, so the UI thread's stop() never waits on the network.
+static constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(5);
+
+static bool connect_until(socket_t s, const sockaddr* addr, socklen_t len,
+                          const std::atomic<bool>& stop) {
+    set_blocking(s, false);
+    int rc = connect(s, addr, len);
+#ifdef _WIN32
+    bool in_progress = rc != 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    bool in_progress = rc != 0 && errno == EINPROGRESS;
+#endif
+    if (rc != 0 && !in_progress) return false;
+
+    auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+    while (rc != 0) {
+        if (stop || std::chrono::steady_clock::now() >= deadline) return false;
+        int ready = wait_socket(s, POLLOUT, 100);
+        if (ready < 0) return false;
+        if (ready == 0) continue;
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        getsockopt(s, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &err_len);
+        if (err != 0) return false;
+        rc = 0;
+    }
+    set_blocking(s, true);
+    return true;
+}
+
+static socket_t connect_to(const std::string& address, std::string& error,
+                           const std::atomic<bool>& stop) {
+    if (address.rfind("unix:", 0) == 0) {
+#ifdef _WIN32
+        error = "unix sockets are not supported on Windows";
+        return SOCKET_INVALID;
+#else
+        std::string path = address.substr(5);
+        sockaddr_un addr{};
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            error = "invalid socket path";
+            return SOCKET_INVALID;
+        }
+        addr.sun_family = AF_UNIX;
+        std::copy(path.begin(), path.end(), addr.sun_path);
+        socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == SOCKET_INVALID) {
+            error = "socket() failed";
+            return SOCKET_INVALID;
+        }
+        if (!connect_until(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr), stop)) {
+            error = "could not connect to " + path;
+            close_socket(s);
+            return SOCKET_INVALID;
+        }
+        return s;
+#endif
+    }
+
+    std::string host = address;
+    uint16_t port = 7780;
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+        host = address.substr(0, colon);
+        int p = std::atoi(address.substr(colon + 1).c_str());
+        if (p > 0 && p < 65536) port = static_cast<uint16_t>(p);
+    }
+    // Resolve in the background so stop() isn't held up by a slow lookup
+    std::string ip;
+    auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+    while (!dns_resolver().try_get(host, ip)) {
+        if (stop || std::chrono::steady_clock::now() >= deadline) {
+            error = "could not resolve " + host;
+            return SOCKET_INVALID;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == SOCKET_INVALID) {
+        error = "socket() failed";
+        return SOCKET_INVALID;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+    if (!connect_until(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr), stop)) {
+        error = "could not connect to " + ip + ":" + std::to_string(port);
+        close_socket(s);
+        return SOCKET_INVALID;
+    }
+    return s;
+}
+
+CollectorClient::~CollectorClient() {
+    stop();
+}
+
+void CollectorClient::start(const std::string& address) {
+    stop();
+    stop_ = false;
+    set_status("connecting");
+    thread_ = std::thread([this, address]() { run(address); });
+}
+
+void CollectorClient::stop() {
+    if (!thread_.joinable()) return;
+    stop_ = true;
+    {
+        // Wake a blocked recv() right away
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (socket_ != -1) {
+#ifdef _WIN32
+            shutdown(static_cast<socket_t>(socket_), SD_BOTH);
+#else
+            shutdown(static_cast<socket_t>(socket_), SHUT_RDWR);
+#endif
+        }
+    }
+    thread_.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.clear();
+    status_.clear();
+}
+
+std::vector<ServerInfo> CollectorClient::take() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<ServerInfo> out;
+    out.swap(pending_);
+    return out;
+}
+
+std::string CollectorClient::status() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return status_;
+}
+
+void CollectorClient::set_status(const std::string& s) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    status_ = s;
+}
+
+void CollectorClient::run(std::string address) {
+    while (!stop_) {
+        if (stream(address) || stop_) continue;
+        // Wait a little before reconnecting
+        for (int i = 0; i < 30 && !stop_; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+// A server record is a few KB; anything near this is a corrupt stream.
+static constexpr size_t MAX_FRAME = 16 << 20;
+
+// One connection: send the request, then decode frames until the collector
+// goes away or stop() is called. Returns false on error.
+bool CollectorClient::stream(const std::string& address) {
+    std::string error;
+    socket_t s = connect_to(address, error, stop_);
+    if (s == SOCKET_INVALID) {
+        if (!stop_) set_status("error: " + error);
+        return stop_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        socket_ = static_cast<int64_t>(s);
+    }
+
+    static const char request[] = "GET /stream HTTP/1.0\r\n\r\n";
+    send(s, request, sizeof(request) - 1, 0);
+
+    std::string buf;
+    bool header_done = false;
+    char chunk[65536];
+    std::vector<uint8_t> record;
+    while (!stop_) {
+        int ready = wait_socket(s, POLLIN, 200);
+        if (ready < 0) break;
+        if (ready == 0) continue;
+
+        int n = recv(s, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            error = "collector closed the connection";
+            break;
+        }
+        buf.append(chunk, static_cast<size_t>(n));
+
+        if (!header_done) {
+            size_t end = buf.find("\r\n\r\n");
+            if (end == std::string::npos) continue;
+            if (buf.compare(0, 12, "HTTP/1.0 200") != 0 && buf.compare(0, 12, "HTTP/1.1 200") != 0) {
+                error = "unexpected reply: " + buf.substr(0, buf.find("\r\n"));
+                break;
+            }
+            buf.erase(0, end + 4);
+            header_done = true;
+            set_status("connected");
+        }
+
+        // Complete frames: 4-byte big-endian length + MessagePack record
+        std::vector<ServerInfo> received;
+        size_t pos = 0;
+        while (buf.size() - pos >= 4) {
+            auto b = reinterpret_cast<const uint8_t*>(buf.data() + pos);
+            size_t len = (size_t(b[0]) << 24) | (size_t(b[1]) << 16) | (size_t(b[2]) << 8) | b[3];
+            if (len > MAX_FRAME) {
+                error = "oversized record from collector";
+                break;
+            }
+            if (buf.size() - pos - 4 < len) break;
+            record.assign(b + 4, b + 4 + len);
+            ServerInfo info;
+            if (read_server(record, info)) {
+                info.queried_at = std::chrono::steady_clock::now();
+                received.push_back(std::move(info));
+            }
+            pos += 4 + len;
+        }
+        buf.erase(0, pos);
+        if (!error.empty()) break;
+
+        if (!received.empty()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& info : received)
+                pending_.push_back(std::move(info));
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        socket_ = -1;
+    }
+    close_socket(s);
+    if (stop_) return true;
+    set_status("error: " + (error.empty() ? std::string("connection lost") : error));
+    return false;
+}
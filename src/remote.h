@@ -0,0 +1,43 @@
+#pragma once
+
+#include "query.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Client side of a collector's /stream endpoint (see collector.h). A
+// background thread keeps the connection open, reconnecting after errors,
+// and decodes each record into a ServerInfo for the UI thread to take().
+// Name lookup and connect give up after a few seconds or as soon as stop()
+// is called, so stopping never waits on an unreachable collector.
+class CollectorClient {
+public:
+    ~CollectorClient();
+
+    // Connect to "host:port" (default port 7780) or "unix:/path".
+    void start(const std::string& address);
+    void stop();
+    bool running() const { return thread_.joinable(); }
+
+    // Results received since the last call, oldest first.
+    std::vector<ServerInfo> take();
+
+    // "connecting", "connected", "error: ..." for the status line.
+    std::string status() const;
+
+private:
+    std::thread thread_;
+    std::atomic<bool> stop_{false};
+    mutable std::mutex mutex_;
+    std::vector<ServerInfo> pending_;
+    std::string status_;
+    int64_t socket_ = -1; // open connection, for stop() to shut down
+
+    void set_status(const std::string& s);
+    void run(std::string address);
+    bool stream(const std::string& address);
+};
@@ -0,0 +1,127 @@
+#include "resolver.h"
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
+
+// Blocking getaddrinfo for the first IPv4 address of `host`.
+static std::string lookup_ipv4(const std::string& host) {
+    struct addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || !res)
+        return {};
+
+    char buf[INET_ADDRSTRLEN] = {};
+    auto* sin = reinterpret_cast<const sockaddr_in*>(res->ai_addr);
+    inet_ntop(AF_INET, &sin->sin_addr, buf, sizeof(buf));
+    freeaddrinfo(res);
+    return buf;
+}
+
+bool DnsResolver::is_ipv4_literal(const std::string& host) {
+    in_addr addr;
+    return inet_pton(AF_INET, host.c_str(), &addr) == 1;
+}
+
+DnsResolver::DnsResolver(int threads) {
+    for (int i = 0; i < threads; ++i)
+        workers_.emplace_back([this]() { worker(); });
+}
+
+DnsResolver::~DnsResolver() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queue_cv_.notify_all();
+    done_cv_.notify_all();
+    for (auto& t : workers_)
+        t.join();
+}
+
+void DnsResolver::enqueue_locked(const std::string& host, Entry& e) {
+    if (e.pending) return;
+    e.pending = true;
+    queue_.push_back(host);
+    queue_cv_.notify_one();
+}
+
+void DnsResolver::worker() {
+    for (;;) {
+        std::string host;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queue_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (stop_) return;
+            host = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        std::string ip = lookup_ipv4(host);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& e = cache_[host];
+            e.pending = false;
+            e.resolved = true;
+            auto now = std::chrono::steady_clock::now();
+            if (!ip.empty()) {
+                e.ip = ip;
+                e.expires = now + ttl;
+            } else {
+                // Keep serving a previously good address through a transient failure
+                e.expires = now + negative_ttl;
+            }
+        }
+        done_cv_.notify_all();
+    }
+}
+
+void DnsResolver::prefetch(const std::string& host) {
+    if (host.empty() || is_ipv4_literal(host)) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& e = cache_[host];
+    if (!e.resolved || std::chrono::steady_clock::now() >= e.expires)
+        enqueue_locked(host, e);
+}
+
+bool DnsResolver::try_get(const std::string& host, std::string& ip) {
+    if (is_ipv4_literal(host)) {
+        ip = host;
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& e = cache_[host];
+    if (!e.resolved || std::chrono::steady_clock::now() >= e.expires)
+        enqueue_locked(host, e);
+    ip = e.ip;
+    return !ip.empty();
+}
+
+std::string DnsResolver::resolve(const std::string& host) {
+    if (host.empty() || is_ipv4_literal(host)) return host;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto& e = cache_[host];
+    if (!e.resolved || std::chrono::steady_clock::now() >= e.expires)
+        enqueue_locked(host, e);
+    // Stale-while-revalidate: only wait if there's nothing to serve yet
+    if (e.ip.empty()) {
+        done_cv_.wait(lock, [this, &host]() {
+            return stop_ || !cache_[host].pending;
+        });
+    }
+    return cache_[host].ip;
+}
+
+DnsResolver& dns_resolver() {
+    static DnsResolver resolver;
+    return resolver;
+}
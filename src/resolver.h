@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Hostname -> IPv4 resolution for favorites and CLI targets.
+//
+// Lookups run on a small pool of resolver threads so many names resolve in
+// parallel, and results are cached for `ttl` (failures for `negative_ttl`).
+// An expired entry is still returned while a refresh runs in the background,
+// so a periodic refresh never waits on DNS once a name has resolved once.
+// IPv4 literals are returned as-is without touching the cache.
+class DnsResolver {
+public:
+    std::chrono::seconds ttl{300};
+    std::chrono::seconds negative_ttl{30};
+
+    explicit DnsResolver(int threads = 4);
+    ~DnsResolver();
+
+    DnsResolver(const DnsResolver&) = delete;
+    DnsResolver& operator=(const DnsResolver&) = delete;
+
+    // Start resolving `host` in the background unless it's cached or pending.
+    void prefetch(const std::string& host);
+
+    // Resolved dotted IPv4 address, or empty if the name doesn't resolve.
+    // Blocks only when the name has never been resolved.
+    std::string resolve(const std::string& host);
+
+    // Cached address without blocking; starts a prefetch on a miss.
+    bool try_get(const std::string& host, std::string& ip);
+
+    static bool is_ipv4_literal(const std::string& host);
+
+private:
+    struct Entry {
+        std::string ip;
+        std::chrono::steady_clock::time_point expires{};
+        bool pending = false;
+        bool resolved = false; // at least one lookup finished
+    };
+
+    std::mutex mutex_;
+    std::condition_variable queue_cv_;
+    std::condition_variable done_cv_;
+    std::unordered_map<std::string, Entry> cache_;
+    std::deque<std::string> queue_;
+    std::vector<std::thread> workers_;
+    bool stop_ = false;
+
+    void enqueue_locked(const std::string& host, Entry& e);
+    void worker();
+};
+
+// Process-wide resolver shared by the GUI and the CLI.
+DnsResolver& dns_resolver();
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Strip all UT2004 color codes (0x1B + R + G + B) from a string, returning plain text.
+inline std::string strip_ut_colors(const std::string& s) {
+    std::string result;
+    result.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (static_cast<unsigned char>(s[i]) == 0x1B && i + 3 < s.size()) {
+            i += 3; // skip ESC + R + G + B
+        } else {
+            result.push_back(s[i]);
+        }
+    }
+    return result;
+}
+
+// Strip color codes and lowercase ASCII letters into `out` (reusing its capacity).
+// Used for case-insensitive matching of server names, maps and player names.
+inline void fold_ut_string(const std::string& s, std::string& out) {
+    out.clear();
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c == 0x1B && i + 3 < s.size()) {
+            i += 3;
+        } else {
+            if (c >= 'A' && c <= 'Z') c = static_cast<unsigned char>(c - 'A' + 'a');
+            out.push_back(static_cast<char>(c));
+        }
+    }
+}
+
+inline std::string fold_ut_string(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    fold_ut_string(s, out);
+    return out;
+}
+
+// Length of the valid UTF-8 sequence starting at s[i] (2-4 bytes), or 0 if
+// the byte at s[i] doesn't start one.
+inline size_t utf8_sequence(std::string_view s, size_t i) {
+    auto c = static_cast<unsigned char>(s[i]);
+    size_t len;
+    if (c >= 0xC2 && c <= 0xDF) len = 2;
+    else if (c >= 0xE0 && c <= 0xEF) len = 3;
+    else if (c >= 0xF0 && c <= 0xF4) len = 4;
+    else return 0;
+    if (i + len > s.size()) return 0;
+    for (size_t k = 1; k < len; ++k)
+        if ((static_cast<unsigned char>(s[i + k]) & 0xC0) != 0x80) return 0;
+    return len;
+}
+
+// Strip color codes and make the text valid UTF-8: UT2004 sends Latin-1, so
+// bytes that aren't part of a valid UTF-8 sequence are transcoded from Latin-1.
+inline std::string ut_to_utf8(std::string_view s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size();) {
+        auto c = static_cast<unsigned char>(s[i]);
+        if (c == 0x1B && i + 3 < s.size()) {
+            i += 4;
+        } else if (c < 0x80) {
+            out.push_back(static_cast<char>(c));
+            ++i;
+        } else if (size_t len = utf8_sequence(s, i)) {
+            out.append(s.data() + i, len);
+            i += len;
+        } else {
+            out.push_back(static_cast<char>(0xC0 | (c >> 6)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+            ++i;
+        }
+    }
+    return out;
+}
@@ -1,23 +1,11 @@
 #pragma once
 
+#include "strutil.h"
+
 #include <imgui.h>
 #include <string>
 #include <vector>
 
-// Strip all UT2004 color codes (0x1B + R + G + B) from a string, returning plain text.
-inline std::string strip_ut_colors(const std::string& s) {
-    std::string result;
-    result.reserve(s.size());
-    for (size_t i = 0; i < s.size(); ++i) {
-        if (static_cast<unsigned char>(s[i]) == 0x1B && i + 3 < s.size()) {
-            i += 3; // skip ESC + R + G + B
-        } else {
-            result.push_back(s[i]);
-        }
-    }
-    return result;
-}
-
 namespace utcolor_detail {
 
 struct ColorSegment {